@@ -0,0 +1,258 @@
+#pragma once
+
+//! Placement of the concore worker threads on the CPUs of the machine.
+//!
+//! concore lets the OS place its worker threads. Here we read the CPU topology (sockets, cores,
+//! SMT siblings, NUMA nodes) and pin each worker to a CPU, from `worker_start_fun_`. Only the
+//! memory that a worker first touches after that lands on its local NUMA node; concore allocates
+//! the state of the workers before the threads start, so that state stays wherever it was
+//! allocated. Only supported on Linux; on other platforms nothing is pinned.
+
+#include <concore/init.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//! How we place the worker threads on the CPUs
+enum class worker_placement {
+    none,    //!< Don't pin the workers; the OS places them freely
+    compact, //!< Fill the CPUs in order: SMT siblings of a core, then the cores of a socket, etc.
+    scatter, //!< Spread the workers: round-robin over sockets, one thread per core first
+};
+
+inline const char* to_string(worker_placement p) {
+    switch (p) {
+    case worker_placement::none:
+        return "none";
+    case worker_placement::compact:
+        return "compact";
+    case worker_placement::scatter:
+        return "scatter";
+    }
+    return "";
+}
+
+inline worker_placement parse_worker_placement(const std::string& str) {
+    if (str == "compact")
+        return worker_placement::compact;
+    if (str == "scatter")
+        return worker_placement::scatter;
+    return worker_placement::none;
+}
+
+//! Configuration for placing the worker threads
+struct placement_config {
+    worker_placement placement_{worker_placement::none};
+    //! If false, we use only one hardware thread per core
+    bool use_smt_{true};
+    //! If true, the workers prefer allocating memory on their local NUMA node
+    bool numa_local_{true};
+};
+
+//! Topology information for a logical CPU
+struct cpu_info {
+    int cpu_{0};       //!< The logical CPU id, as known by the OS
+    int package_{0};   //!< The socket
+    int core_{0};      //!< The core id (unique within a socket)
+    int smt_index_{0}; //!< The index of this CPU among the hardware threads of its core
+    int node_{0};      //!< The NUMA node
+};
+
+namespace detail {
+//! Reads a single integer from the given file; returns the default if it cannot be read
+inline int read_int_file(const std::string& path, int def) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+        return def;
+    int val = def;
+    if (fscanf(f, "%d", &val) != 1)
+        val = def;
+    fclose(f);
+    return val;
+}
+
+//! Parses a CPU list of the form "0-3,8,10-11"
+inline std::vector<int> parse_cpu_list(const std::string& str) {
+    std::vector<int> res;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos)
+            end = str.size();
+        std::string part = str.substr(pos, end - pos);
+        int lo = 0;
+        int hi = 0;
+        int n = sscanf(part.c_str(), "%d-%d", &lo, &hi);
+        if (n == 1)
+            res.push_back(lo);
+        else if (n == 2)
+            for (int i = lo; i <= hi; i++)
+                res.push_back(i);
+        pos = end + 1;
+    }
+    return res;
+}
+
+inline std::string read_line_file(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+        return {};
+    char buf[4096] = {0};
+    if (!fgets(buf, sizeof(buf), f))
+        buf[0] = 0;
+    fclose(f);
+    std::string res = buf;
+    while (!res.empty() && (res.back() == '\n' || res.back() == ' '))
+        res.pop_back();
+    return res;
+}
+} // namespace detail
+
+//! Reads the topology of the online CPUs.
+//! If the topology cannot be read, we assume each CPU is a separate core on a single socket.
+inline std::vector<cpu_info> read_cpu_topology() {
+    std::vector<cpu_info> res;
+#if defined(__linux__)
+    const std::string base = "/sys/devices/system/cpu/";
+    for (int cpu : detail::parse_cpu_list(detail::read_line_file(base + "online"))) {
+        std::string dir = base + "cpu" + std::to_string(cpu) + "/topology/";
+        cpu_info info;
+        info.cpu_ = cpu;
+        info.package_ = detail::read_int_file(dir + "physical_package_id", 0);
+        info.core_ = detail::read_int_file(dir + "core_id", cpu);
+        res.push_back(info);
+    }
+    // NUMA nodes
+    if (DIR* d = opendir("/sys/devices/system/node/")) {
+        while (dirent* entry = readdir(d)) {
+            int node = 0;
+            if (sscanf(entry->d_name, "node%d", &node) != 1)
+                continue;
+            std::string path = "/sys/devices/system/node/" + std::string(entry->d_name);
+            path += "/cpulist";
+            for (int cpu : detail::parse_cpu_list(detail::read_line_file(path)))
+                for (auto& info : res)
+                    if (info.cpu_ == cpu)
+                        info.node_ = node;
+        }
+        closedir(d);
+    }
+#endif
+    if (res.empty()) {
+        int n = std::max(1, int(std::thread::hardware_concurrency()));
+        for (int i = 0; i < n; i++) {
+            cpu_info info;
+            info.cpu_ = i;
+            info.core_ = i;
+            res.push_back(info);
+        }
+    }
+    // Compute the index of each CPU among its SMT siblings
+    for (auto& info : res) {
+        info.smt_index_ = 0;
+        for (const auto& other : res)
+            if (other.package_ == info.package_ && other.core_ == info.core_ &&
+                    other.cpu_ < info.cpu_)
+                info.smt_index_++;
+    }
+    return res;
+}
+
+//! Returns the order in which the workers should be placed on the CPUs.
+//! Worker `i` is placed on CPU `result[i % result.size()]`.
+inline std::vector<int> placement_order(
+        std::vector<cpu_info> cpus, worker_placement placement, bool use_smt) {
+    if (!use_smt)
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+                           [](const cpu_info& c) { return c.smt_index_ > 0; }),
+                cpus.end());
+
+    if (placement == worker_placement::compact) {
+        std::sort(cpus.begin(), cpus.end(), [](const cpu_info& l, const cpu_info& r) {
+            return std::tie(l.node_, l.package_, l.core_, l.smt_index_) <
+                   std::tie(r.node_, r.package_, r.core_, r.smt_index_);
+        });
+    } else if (placement == worker_placement::scatter) {
+        // Rank of each core within its package, so that we can alternate between the packages
+        std::vector<std::pair<int, cpu_info>> ranked;
+        for (const auto& c : cpus) {
+            int rank = 0;
+            for (const auto& other : cpus)
+                if (other.package_ == c.package_ && other.smt_index_ == 0 && other.core_ < c.core_)
+                    rank++;
+            ranked.emplace_back(rank, c);
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const auto& l, const auto& r) {
+            return std::tie(l.second.smt_index_, l.first, l.second.package_) <
+                   std::tie(r.second.smt_index_, r.first, r.second.package_);
+        });
+        for (size_t i = 0; i < cpus.size(); i++)
+            cpus[i] = ranked[i].second;
+    }
+
+    std::vector<int> res;
+    res.reserve(cpus.size());
+    for (const auto& c : cpus)
+        res.push_back(c.cpu_);
+    return res;
+}
+
+//! Pins the current thread to the given CPU; returns false if this is not possible
+inline bool pin_current_thread(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+//! Makes the current thread prefer allocating memory on the NUMA node it runs on
+inline bool use_local_numa_allocation() {
+#if defined(__linux__)
+    constexpr int mpol_local = 4; // MPOL_LOCAL, from <linux/mempolicy.h>
+    return syscall(SYS_set_mempolicy, mpol_local, nullptr, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+//! Sets up the init data so that the workers are placed according to the given configuration.
+//! Each worker is pinned as soon as it starts, before doing any work.
+inline void apply_placement(concore::init_data& config, const placement_config& placement) {
+    if (placement.placement_ == worker_placement::none)
+        return;
+
+    auto order = placement_order(read_cpu_topology(), placement.placement_, placement.use_smt_);
+    if (order.empty())
+        return;
+    auto next_worker = std::make_shared<std::atomic<int>>(0);
+    bool numa_local = placement.numa_local_;
+    auto prev_start_fun = config.worker_start_fun_;
+    config.worker_start_fun_ = [order, next_worker, numa_local, prev_start_fun] {
+        int idx = (*next_worker)++;
+        pin_current_thread(order[idx % order.size()]);
+        if (numa_local)
+            use_local_numa_allocation();
+        if (prev_start_fun)
+            prev_start_fun();
+    };
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+//! Counts the heap allocations made by the program.
+//!
+//! We replace the global `operator new`/`operator delete`, so that every allocation increments a
+//! counter. The replacement functions must be defined exactly once in a program: put
+//! `ALLOC_COUNTER_DEFINE_OPERATORS` at global scope in one source file. The examples in
+//! `performance/` do it only when they are not linked into the benchmark driver, which defines
+//! the operators itself.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace alloc_counter {
+
+inline std::atomic<uint64_t>& num_allocations() {
+    static std::atomic<uint64_t> instance{0};
+    return instance;
+}
+
+//! The number of allocations made so far; only counts if the operators are defined
+inline uint64_t count() { return num_allocations().load(std::memory_order_relaxed); }
+
+inline void* allocate(std::size_t size) {
+    num_allocations().fetch_add(1, std::memory_order_relaxed);
+    void* res = std::malloc(size ? size : 1);
+    if (!res)
+        throw std::bad_alloc{};
+    return res;
+}
+
+//! Frees memory obtained from `allocate`. Not inlined into the replaced `operator delete`:
+//! otherwise GCC sees `free` called on the result of `operator new`, and warns about a mismatch.
+[[gnu::noinline]] inline void deallocate(void* p) noexcept { std::free(p); }
+
+} // namespace alloc_counter
+
+#define ALLOC_COUNTER_DEFINE_OPERATORS                                                             \
+    void* operator new(std::size_t size) { return alloc_counter::allocate(size); }                 \
+    void* operator new[](std::size_t size) { return alloc_counter::allocate(size); }               \
+    void operator delete(void* p) noexcept { alloc_counter::deallocate(p); }                       \
+    void operator delete[](void* p) noexcept { alloc_counter::deallocate(p); }                     \
+    void operator delete(void* p, std::size_t) noexcept { alloc_counter::deallocate(p); }          \
+    void operator delete[](void* p, std::size_t) noexcept { alloc_counter::deallocate(p); }
@@ -0,0 +1,1113 @@
+#pragma once
+
+//! Pipelines whose stages can process batches of items.
+//!
+//! `concore::pipeline` runs one task per item, per stage; for cheap stages, the overhead of the
+//! tasks dominates. A `batched_pipeline` has the same stage orderings, but a stage can declare a
+//! batch size, and receive an `item_span` with up to that many items. The orderings hold at batch
+//! granularity:
+//!     - an `in_order` stage gets batches of consecutive items, in the order they were pushed, and
+//!       processes one batch at a time
+//!     - an `out_of_order` stage processes one batch at a time, in any order
+//!     - a `concurrent` stage can process several batches in parallel
+//!
+//! Batches are formed from the items already waiting for the stage; a stage never waits for a
+//! batch to fill up. When a stage keeps up with its input, its batches are small, and the latency
+//! stays low; when items queue up in front of it, it processes them in large batches. A task keeps
+//! processing batches as long as it finds items ready for its stage, so a busy serial stage doesn't
+//! need a new task for every batch.
+//!
+//! As with `concore::pipeline`, at most `max_concurrency` items are in flight; the items pushed
+//! beyond that wait for the items in flight to finish. The stage functions should not throw.
+//!
+//! Backpressure: by default, `push()` never blocks, and the items waiting to enter the pipeline can
+//! grow without bound when the producer is faster than the pipeline. The builder can limit the
+//! number of waiting items (`queue_capacity`), and the memory of all the items in the pipeline
+//! (`memory_budget`, with a function giving the size of an item). When the pipeline is full:
+//!     - `push()` blocks until there is room; don't call it from a task the pipeline may need
+//!     - `try_push()` returns false, leaving the item with the caller
+//!     - `push_async()` keeps the item, and spawns the given continuation once it's accepted; a
+//!       producer that pushes its next item from the continuation never blocks a thread
+//!
+//! Statistics: with `collect_stats()` on the builder, the pipeline measures, for each stage, the
+//! items and batches processed, the time spent in the stage function, the length of the queue in
+//! front of it, and, for `in_order` stages, how long the items waited for earlier items to arrive.
+//! It also measures how many items were in flight. `print_pipeline_report` prints them, and names
+//! the bottleneck: the stage with the highest utilization. A serial stage can process one batch at
+//! a time; a concurrent stage, as many as the number of hardware threads (or more, if we've seen
+//! more batches processed at the same time, e.g., with stages that block), but no more than
+//! `max_concurrency`. Stages can be named with `named(name, f)`.
+//!
+//! Adaptive concurrency: with `adaptive_concurrency()` on the builder, `max_concurrency` is only an
+//! upper bound; the pipeline adjusts its limit of items in flight as it runs. It measures the
+//! service time of each stage (the time in the stage function, per item), and applies Little's
+//! law: to sustain throughput X with items spending R in the stages, we need X * R items in
+//! flight. R is the sum of the service times; X is limited by the slowest serial stage, and by the
+//! workers, which can't process more than `num_workers` items at once. The limit gets some
+//! headroom over X * R, for the variation of the service times and for the reordering. Queueing
+//! time is deliberately left out of R: it grows with the limit, and would only feed on itself.
+//!
+//! Item slots: instead of pushing a new item, the producer can `acquire()` a slot from the pool of
+//! the pipeline, fill the item in place, and push the slot. After the last stage, the item goes
+//! back to the pool without being destroyed, so the next producer that acquires it can reuse its
+//! buffers; once the pool holds enough slots, pushing items doesn't allocate. A slot holds whatever
+//! its previous item left in it; the producer must reset all its fields. The pool grows to the
+//! number of items in the pipeline at once; bound it with `queue_capacity` or `memory_budget`.
+//! Items pushed by value are still destroyed after the last stage.
+//!
+//! The tasks of the pipeline refer to its state; destroying the last copy of the pipeline waits
+//! until all the items pushed into it are done. Slots must be pushed or destroyed before that.
+//!
+//! The syntax mirrors `concore::pipeline_builder`:
+//!     auto p = batched_pipeline_builder<frame_data>(max_concurrency, grp)
+//!             | concore::stage_ordering::in_order
+//!             | parse_frame                                   // void(frame_data&)
+//!             | concore::stage_ordering::out_of_order
+//!             | in_batches(16, postprocess_frames)            // void(item_span<frame_data>)
+//!             | concore::pipeline_end;
+
+#include "profiling.hpp"
+#include "results_table.hpp"
+
+#include <concore/pipeline.hpp>
+#include <concore/spawn.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//! A batch of items given to a stage; the items are not contiguous in memory
+template <typename T>
+class item_span {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T*;
+        using reference = T&;
+
+        explicit iterator(T* const* p)
+            : p_(p) {}
+        T& operator*() const { return **p_; }
+        T* operator->() const { return *p_; }
+        iterator& operator++() {
+            ++p_;
+            return *this;
+        }
+        iterator operator++(int) { return iterator{p_++}; }
+        bool operator==(const iterator& other) const { return p_ == other.p_; }
+        bool operator!=(const iterator& other) const { return p_ != other.p_; }
+
+    private:
+        T* const* p_;
+    };
+
+    item_span(T* const* items, size_t size)
+        : items_(items)
+        , size_(size) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T& operator[](size_t i) const { return *items_[i]; }
+    iterator begin() const { return iterator{items_}; }
+    iterator end() const { return iterator{items_ + size_}; }
+
+private:
+    T* const* items_;
+    size_t size_;
+};
+
+//! A stage function that takes batches of up to `batch_size_` items; see `in_batches`
+template <typename F>
+struct batch_stage_fun {
+    size_t batch_size_;
+    F fun_;
+};
+
+//! Declares a batched stage: `f(item_span<T>)` is called with up to `batch_size` items at once
+template <typename F>
+batch_stage_fun<std::decay_t<F>> in_batches(size_t batch_size, F&& f) {
+    assert(batch_size > 0);
+    return {batch_size, std::forward<F>(f)};
+}
+
+//! A stage function with a name, for the statistics; see `named`
+template <typename F>
+struct named_stage_fun {
+    std::string name_;
+    F fun_;
+};
+
+//! Gives a name to a stage; `f` can be a function of an item, or the result of `in_batches`
+template <typename F>
+named_stage_fun<std::decay_t<F>> named(std::string name, F&& f) {
+    return {std::move(name), std::forward<F>(f)};
+}
+
+inline const char* stage_ordering_name(concore::stage_ordering ordering) {
+    switch (ordering) {
+    case concore::stage_ordering::in_order:
+        return "in_order";
+    case concore::stage_ordering::out_of_order:
+        return "out_of_order";
+    case concore::stage_ordering::concurrent:
+        return "concurrent";
+    }
+    return "";
+}
+
+//! The measurements of a stage; see `batched_pipeline::stats()`
+struct pipeline_stage_stats {
+    std::string name_;
+    concore::stage_ordering ordering_{concore::stage_ordering::in_order};
+    uint64_t items_{0};
+    uint64_t batches_{0};
+    //! The time spent in the stage function
+    double busy_ms_{0};
+    //! The average time spent in the stage function per item, in microseconds
+    double service_us_{0};
+    //! The average number of batches being processed at the same time
+    double mean_busy_{0};
+    //! `mean_busy_`, relative to the number of batches the stage can process at the same time
+    double utilization_{0};
+    //! The average and maximum number of items waiting for the stage
+    double mean_queue_{0};
+    size_t max_queue_{0};
+    //! For `in_order` stages: the average time an item waited for earlier items, in microseconds
+    double reorder_wait_us_{0};
+};
+
+//! The measurements of a pipeline, from the first push to the end of the last item
+struct pipeline_stats {
+    double elapsed_ms_{0};
+    uint64_t items_{0};
+    int max_concurrency_{0};
+    //! The limit of items in flight at the end; lower than `max_concurrency_` if adaptive
+    int concurrency_limit_{0};
+    double mean_in_flight_{0};
+    int max_in_flight_{0};
+    std::vector<pipeline_stage_stats> stages_;
+    //! The index of the stage with the highest utilization; -1 if there are no measurements
+    int bottleneck_{-1};
+};
+
+namespace detail {
+
+inline uint64_t pipeline_now_ns() {
+    using namespace std::chrono;
+    return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+//! An item going through the pipeline, and its position in the push order
+template <typename T>
+struct pipeline_line {
+    T data_;
+    uint64_t seq_;
+    //! The size of the item, counted against the memory budget
+    size_t bytes_;
+    //! When the item arrived at its current stage; only set when collecting statistics
+    uint64_t arrival_ns_{0};
+    //! The next line in the waiting queue, or in the pool
+    pipeline_line* next_{nullptr};
+    //! Whether the line comes from the pool, and goes back to it after the last stage
+    bool recycled_{false};
+};
+
+//! A FIFO queue of lines, linked through their `next_` pointers; never allocates
+template <typename T>
+class pipeline_line_queue {
+public:
+    using line = pipeline_line<T>;
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    line* front() const { return head_; }
+
+    void push_back(line* l) {
+        l->next_ = nullptr;
+        if (tail_)
+            tail_->next_ = l;
+        else
+            head_ = l;
+        tail_ = l;
+        size_++;
+    }
+    line* pop_front() {
+        line* l = head_;
+        head_ = l->next_;
+        if (!head_)
+            tail_ = nullptr;
+        l->next_ = nullptr;
+        size_--;
+        return l;
+    }
+
+private:
+    line* head_{nullptr};
+    line* tail_{nullptr};
+    size_t size_{0};
+};
+
+//! How many items the pipeline accepts before `push` blocks
+template <typename T>
+struct pipeline_limits {
+    //! The maximum number of items waiting to enter the pipeline
+    size_t queue_capacity_{SIZE_MAX};
+    //! The maximum size of all the items in the pipeline (in flight and waiting), in bytes
+    size_t memory_budget_{SIZE_MAX};
+    //! Gives the size of an item, for the memory budget
+    std::function<size_t(const T&)> item_size_;
+};
+
+//! The settings for adjusting the limit of items in flight; see `adaptive_concurrency()`
+struct pipeline_adaptive_settings {
+    bool enabled_{false};
+    //! The limit never goes below this
+    int min_concurrency_{1};
+    //! The number of worker threads that execute the stages
+    int num_workers_{1};
+    //! The limit is `headroom_` times the number of items in flight needed by Little's law
+    double headroom_{1.5};
+};
+
+//! A stage of the pipeline, and the items waiting for it
+template <typename T>
+struct pipeline_stage {
+    using line = pipeline_line<T>;
+
+    concore::stage_ordering ordering_;
+    size_t batch_size_;
+    std::function<void(item_span<T>)> fun_;
+    std::string name_;
+    //! Whether we collect all the statistics
+    bool measure_{false};
+    //! Whether we measure the time spent in the stage function; needed by the statistics, and
+    //! for the adaptive concurrency
+    bool time_batches_{false};
+
+    std::mutex mutex_;
+    //! The items waiting for this stage; there can't be more than `max_concurrency`. For
+    //! `in_order` stages, item `seq` is at `seq % capacity`: the items waiting are within
+    //! `max_concurrency` of the next one. For the other stages, a FIFO queue starting at `head_`.
+    std::vector<line*> pending_;
+    size_t head_{0};
+    size_t num_pending_{0};
+    //! For serial stages: whether there is a task that processes (or will process) the items
+    bool active_{false};
+    //! For concurrent stages: the number of tasks spawned that haven't taken a batch yet
+    size_t num_scheduled_{0};
+    //! For `in_order` stages: the next item to be processed
+    uint64_t next_seq_{0};
+
+    //! The statistics of the stage, accumulated while holding the lock
+    struct counters {
+        uint64_t items_{0};
+        uint64_t batches_{0};
+        double busy_ns_{0};
+        //! The integral of the queue length over time, in items * ns
+        double queue_area_{0};
+        uint64_t last_queue_change_ns_{0};
+        size_t max_queue_{0};
+        double reorder_wait_ns_{0};
+        //! The latest arrival among the items already taken, for `in_order` stages
+        uint64_t latest_arrival_ns_{0};
+        //! The number of batches being processed now, and its maximum
+        int num_busy_{0};
+        int max_busy_{0};
+        //! The time and the items processed since the last adjustment of the concurrency limit
+        double window_busy_ns_{0};
+        uint64_t window_items_{0};
+        //! The smoothed service time per item, in ns; updated at each adjustment
+        double service_ns_{0};
+    };
+    counters counters_;
+
+    pipeline_stage(concore::stage_ordering ordering, size_t batch_size,
+            std::function<void(item_span<T>)> f, std::string name, int max_concurrency)
+        : ordering_(ordering)
+        , batch_size_(batch_size)
+        , fun_(std::move(f))
+        , name_(std::move(name))
+        , pending_(size_t(max_concurrency), nullptr) {}
+
+    //! Called with the lock held, before the length of the queue changes
+    void record_queue_change(uint64_t now) {
+        auto& c = counters_;
+        c.queue_area_ += double(num_pending_) * double(now - c.last_queue_change_ns_);
+        c.last_queue_change_ns_ = now;
+    }
+
+    //! Called with the lock held
+    void add(line* l) {
+        size_t pos = ordering_ == concore::stage_ordering::in_order
+                             ? size_t(l->seq_ % pending_.size())
+                             : (head_ + num_pending_) % pending_.size();
+        assert(num_pending_ < pending_.size() && !pending_[pos]);
+        pending_[pos] = l;
+        num_pending_++;
+    }
+
+    bool has_ready() const {
+        if (num_pending_ == 0)
+            return false;
+        return ordering_ != concore::stage_ordering::in_order ||
+               pending_[next_seq_ % pending_.size()] != nullptr;
+    }
+
+    //! Called with the lock held, after adding items; returns the number of tasks to spawn
+    size_t tasks_to_spawn() {
+        if (ordering_ != concore::stage_ordering::concurrent) {
+            if (active_ || !has_ready())
+                return 0;
+            active_ = true;
+            return 1;
+        }
+        size_t wanted = (num_pending_ + batch_size_ - 1) / batch_size_;
+        if (wanted <= num_scheduled_)
+            return 0;
+        size_t res = wanted - num_scheduled_;
+        num_scheduled_ = wanted;
+        return res;
+    }
+
+    //! Called with the lock held; moves the next batch of ready items to `out`
+    size_t take_batch(line** out) {
+        if (measure_ && has_ready())
+            record_queue_change(pipeline_now_ns());
+        size_t n = 0;
+        if (has_ready()) {
+            counters_.num_busy_++;
+            counters_.max_busy_ = std::max(counters_.max_busy_, counters_.num_busy_);
+        }
+        while (n < batch_size_ && has_ready()) {
+            size_t pos = head_;
+            if (ordering_ == concore::stage_ordering::in_order)
+                pos = size_t(next_seq_++ % pending_.size());
+            else
+                head_ = (head_ + 1) % pending_.size();
+            out[n++] = pending_[pos];
+            pending_[pos] = nullptr;
+            num_pending_--;
+        }
+        if (measure_ && ordering_ == concore::stage_ordering::in_order) {
+            // The item couldn't be processed before all the earlier items arrived
+            for (size_t i = 0; i < n; i++) {
+                uint64_t arrival = out[i]->arrival_ns_;
+                if (arrival < counters_.latest_arrival_ns_)
+                    counters_.reorder_wait_ns_ += double(counters_.latest_arrival_ns_ - arrival);
+                else
+                    counters_.latest_arrival_ns_ = arrival;
+            }
+        }
+        return n;
+    }
+
+    //! Called with the lock held, after processing a batch
+    void record_batch(size_t n, uint64_t busy_ns) {
+        counters_.num_busy_--;
+        counters_.items_ += n;
+        counters_.batches_++;
+        counters_.busy_ns_ += double(busy_ns);
+        counters_.window_busy_ns_ += double(busy_ns);
+        counters_.window_items_ += n;
+    }
+
+    //! Updates the service time with the measurements since the last call, and returns it
+    double update_service_time() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto& c = counters_;
+        if (c.window_items_ > 0) {
+            double latest = c.window_busy_ns_ / double(c.window_items_);
+            c.service_ns_ = c.service_ns_ == 0 ? latest : (c.service_ns_ + latest) / 2;
+            c.window_busy_ns_ = 0;
+            c.window_items_ = 0;
+        }
+        return c.service_ns_;
+    }
+};
+
+//! The state of a pipeline; shared by the copies of the pipeline object. The tasks that process
+//! its items refer to it, without owning it: a task capturing a `shared_ptr` can't be stored in
+//! `std::function` without allocating.
+template <typename T>
+class pipeline_impl {
+public:
+    using line = pipeline_line<T>;
+    using stage = pipeline_stage<T>;
+
+    pipeline_impl(int max_concurrency, concore::task_group grp,
+            std::vector<std::unique_ptr<stage>> stages, pipeline_limits<T> limits,
+            pipeline_adaptive_settings adaptive, bool measure)
+        : max_concurrency_(max_concurrency)
+        , grp_(std::move(grp))
+        , stages_(std::move(stages))
+        , limits_(std::move(limits))
+        , adaptive_(adaptive)
+        , measure_(measure)
+        , limit_(max_concurrency) {
+        for (auto& s : stages_) {
+            s->measure_ = measure;
+            s->time_batches_ = measure || adaptive.enabled_;
+        }
+        // Until we measure something, assume that we need one item per worker
+        if (adaptive.enabled_)
+            limit_ = std::min(max_concurrency,
+                    std::max(adaptive.min_concurrency_, std::max(1, adaptive.num_workers_)));
+    }
+
+    //! The current limit of items in flight
+    int concurrency_limit() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return limit_;
+    }
+    ~pipeline_impl() {
+        // Wait for the tasks still processing items
+        while (num_tasks_.load(std::memory_order_acquire) > 0)
+            std::this_thread::yield();
+        while (!waiting_.empty())
+            delete waiting_.pop_front();
+        for (auto& p : async_pushes_)
+            delete p.line_;
+        while (free_lines_) {
+            line* l = free_lines_;
+            free_lines_ = l->next_;
+            delete l;
+        }
+    }
+
+    //! Returns a line from the pool; creates a new one only if the pool is empty
+    line* acquire_line() {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (line* l = free_lines_) {
+                free_lines_ = l->next_;
+                l->next_ = nullptr;
+                return l;
+            }
+        }
+        auto* l = new line{T{}, 0, 0};
+        l->recycled_ = true;
+        return l;
+    }
+
+    //! Puts back in the pool a line acquired but not pushed
+    void release_line(line* l) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        recycle(l);
+    }
+
+    void push(T&& item) { push(new line{std::move(item), 0, 0}); }
+
+    //! Pushes the item of the line; blocks while the pipeline is full
+    void push(line* l) {
+        size_t bytes = item_bytes(l->data_);
+        line* to_start = nullptr;
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            room_available_.wait(lock, [&] { return async_pushes_.empty() && has_room(bytes); });
+            accept(l, bytes);
+            admit(&to_start, 1);
+        }
+        if (to_start)
+            enqueue(0, &to_start, 1);
+    }
+
+    bool try_push(T&& item) {
+        // Only move the item into a line if the pipeline accepts it
+        return try_push_line(item_bytes(item), [&item] { return new line{std::move(item), 0, 0}; });
+    }
+    bool try_push(line* l) {
+        return try_push_line(item_bytes(l->data_), [l] { return l; });
+    }
+
+    void push_async(T&& item, concore::task on_accepted) {
+        push_async(new line{std::move(item), 0, 0}, std::move(on_accepted));
+    }
+    void push_async(line* l, concore::task on_accepted) {
+        size_t bytes = item_bytes(l->data_);
+        line* to_start = nullptr;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (!async_pushes_.empty() || !has_room(bytes)) {
+                async_pushes_.push_back({l, bytes, std::move(on_accepted)});
+                return;
+            }
+            accept(l, bytes);
+            admit(&to_start, 1);
+        }
+        if (to_start)
+            enqueue(0, &to_start, 1);
+        concore::spawn(std::move(on_accepted));
+    }
+
+    pipeline_stats stats() {
+        pipeline_stats res;
+        res.max_concurrency_ = max_concurrency_;
+        double elapsed_ns = 0;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            res.concurrency_limit_ = limit_;
+            if (end_ns_ > start_ns_)
+                elapsed_ns = double(end_ns_ - start_ns_);
+            res.items_ = items_done_;
+            res.max_in_flight_ = max_in_flight_;
+            if (elapsed_ns > 0)
+                res.mean_in_flight_ = in_flight_area_ / elapsed_ns;
+        }
+        res.elapsed_ms_ = elapsed_ns / 1e6;
+        int hw_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+        double max_utilization = -1;
+        for (size_t i = 0; i < stages_.size(); i++) {
+            auto& s = *stages_[i];
+            pipeline_stage_stats st;
+            st.name_ = s.name_;
+            st.ordering_ = s.ordering_;
+            std::lock_guard<std::mutex> lock{s.mutex_};
+            const auto& c = s.counters_;
+            st.items_ = c.items_;
+            st.batches_ = c.batches_;
+            st.busy_ms_ = c.busy_ns_ / 1e6;
+            st.max_queue_ = c.max_queue_;
+            if (c.items_ > 0) {
+                st.service_us_ = c.busy_ns_ / 1e3 / double(c.items_);
+                st.reorder_wait_us_ = c.reorder_wait_ns_ / 1e3 / double(c.items_);
+            }
+            if (elapsed_ns > 0) {
+                st.mean_busy_ = c.busy_ns_ / elapsed_ns;
+                st.mean_queue_ = c.queue_area_ / elapsed_ns;
+                int parallelism = 1;
+                if (s.ordering_ == concore::stage_ordering::concurrent)
+                    parallelism = std::min(max_concurrency_, std::max(hw_threads, c.max_busy_));
+                st.utilization_ = st.mean_busy_ / parallelism;
+            }
+            if (elapsed_ns > 0 && st.utilization_ > max_utilization) {
+                max_utilization = st.utilization_;
+                res.bottleneck_ = int(i);
+            }
+            res.stages_.push_back(std::move(st));
+        }
+        return res;
+    }
+
+private:
+    //! Scratch space for the batches, reused by all the tasks executed by a thread
+    struct batch_buffer {
+        std::vector<line*> lines_;
+        std::vector<T*> items_;
+    };
+    //! An item given to `push_async` while the pipeline was full
+    struct async_push {
+        line* line_;
+        size_t bytes_;
+        concore::task on_accepted_;
+    };
+
+    int max_concurrency_;
+    concore::task_group grp_;
+    std::vector<std::unique_ptr<stage>> stages_;
+    pipeline_limits<T> limits_;
+    pipeline_adaptive_settings adaptive_;
+    bool measure_;
+
+    //! Protects the admission of the items
+    std::mutex mutex_;
+    uint64_t next_seq_{0};
+    int in_flight_{0};
+    //! The maximum number of items in flight; `max_concurrency_`, unless adaptive
+    int limit_;
+    //! The items finished since the last adjustment of `limit_`
+    int finished_since_adjust_{0};
+    //! The size of the items in flight and waiting
+    size_t bytes_{0};
+    //! The items accepted while `limit_` items were in flight, in push order
+    pipeline_line_queue<T> waiting_;
+    //! The pool of lines for the slots, linked through `next_`
+    line* free_lines_{nullptr};
+    //! The asynchronous pushes that didn't fit in the pipeline yet, in push order
+    std::deque<async_push> async_pushes_;
+    //! Notified when items leave the pipeline, for the blocked `push` calls
+    std::condition_variable room_available_;
+    //! The number of tasks spawned that haven't finished yet
+    std::atomic<size_t> num_tasks_{0};
+
+    // Statistics, protected by the mutex; only updated when measuring
+    uint64_t start_ns_{0};
+    uint64_t end_ns_{0};
+    uint64_t items_done_{0};
+    //! The integral of the number of items in flight over time, in items * ns
+    double in_flight_area_{0};
+    uint64_t last_in_flight_change_ns_{0};
+    int max_in_flight_{0};
+
+    //! Called with the lock held, before the number of items in flight changes
+    void record_in_flight_change() {
+        uint64_t now = pipeline_now_ns();
+        if (start_ns_ == 0)
+            start_ns_ = now;
+        else
+            in_flight_area_ += double(in_flight_) * double(now - last_in_flight_change_ns_);
+        last_in_flight_change_ns_ = now;
+    }
+
+    size_t item_bytes(const T& item) const {
+        return limits_.item_size_ ? limits_.item_size_(item) : 0;
+    }
+
+    //! Called with the lock held; tells if we can accept an item of the given size. An item larger
+    //! than the memory budget is accepted when the pipeline is empty.
+    bool has_room(size_t bytes) const {
+        bool queue_ok = in_flight_ < limit_ || waiting_.size() < limits_.queue_capacity_;
+        bool memory_ok = in_flight_ == 0 || bytes_ + bytes <= limits_.memory_budget_;
+        return queue_ok && memory_ok;
+    }
+
+    //! Pushes the line made by `make_line` if there is room for `bytes`; otherwise returns false
+    template <typename MakeLine>
+    bool try_push_line(size_t bytes, MakeLine make_line) {
+        line* to_start = nullptr;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (!async_pushes_.empty() || !has_room(bytes))
+                return false;
+            accept(make_line(), bytes);
+            admit(&to_start, 1);
+        }
+        if (to_start)
+            enqueue(0, &to_start, 1);
+        return true;
+    }
+
+    //! Called with the lock held; adds the item at the end of the waiting queue
+    void accept(line* l, size_t bytes) {
+        l->seq_ = next_seq_++;
+        l->bytes_ = bytes;
+        waiting_.push_back(l);
+        bytes_ += bytes;
+    }
+
+    //! Called with the lock held; puts the line in the pool, keeping its item
+    void recycle(line* l) {
+        l->next_ = free_lines_;
+        free_lines_ = l;
+    }
+
+    //! Called with the lock held; moves up to `max` waiting items in flight, and returns them
+    size_t admit(line** out, size_t max) {
+        if (measure_ && in_flight_ < limit_ && !waiting_.empty())
+            record_in_flight_change();
+        size_t n = 0;
+        while (n < max && in_flight_ < limit_ && !waiting_.empty()) {
+            out[n++] = waiting_.pop_front();
+            in_flight_++;
+        }
+        max_in_flight_ = std::max(max_in_flight_, in_flight_);
+        return n;
+    }
+
+    //! Gives the items to stage `idx`, and spawns the tasks needed to process them
+    void enqueue(size_t idx, line** lines, size_t n) {
+        if (idx == stages_.size()) {
+            finish(lines, n);
+            return;
+        }
+        auto& s = *stages_[idx];
+        size_t to_spawn = 0;
+        {
+            std::lock_guard<std::mutex> lock{s.mutex_};
+            if (s.measure_) {
+                uint64_t now = pipeline_now_ns();
+                s.record_queue_change(now);
+                for (size_t i = 0; i < n; i++)
+                    lines[i]->arrival_ns_ = now;
+            }
+            for (size_t i = 0; i < n; i++)
+                s.add(lines[i]);
+            s.counters_.max_queue_ = std::max(s.counters_.max_queue_, s.num_pending_);
+            to_spawn = s.tasks_to_spawn();
+        }
+        if (to_spawn == 0)
+            return;
+        num_tasks_.fetch_add(to_spawn, std::memory_order_relaxed);
+        for (size_t i = 0; i < to_spawn; i++)
+            concore::spawn(concore::task{[this, idx] { run_stage(idx); }, grp_});
+    }
+
+    //! The body of the tasks of stage `idx`: processes batches while there are items ready
+    void run_stage(size_t idx) {
+        CONCORE_PROFILING_FUNCTION();
+        auto& s = *stages_[idx];
+
+        // Use the buffers of this thread; a stage function that executes tasks inline gets new ones
+        static thread_local batch_buffer thread_buffer;
+        batch_buffer buf;
+        std::swap(buf, thread_buffer);
+        buf.lines_.resize(std::max(buf.lines_.size(), s.batch_size_));
+        buf.items_.resize(buf.lines_.size());
+
+        std::unique_lock<std::mutex> lock{s.mutex_};
+        if (s.ordering_ == concore::stage_ordering::concurrent)
+            s.num_scheduled_--;
+        while (true) {
+            size_t n = s.take_batch(buf.lines_.data());
+            if (n == 0)
+                break;
+            lock.unlock();
+            for (size_t i = 0; i < n; i++)
+                buf.items_[i] = &buf.lines_[i]->data_;
+            uint64_t t0 = s.time_batches_ ? pipeline_now_ns() : 0;
+            s.fun_(item_span<T>{buf.items_.data(), n});
+            uint64_t busy_ns = s.time_batches_ ? pipeline_now_ns() - t0 : 0;
+            enqueue(idx + 1, buf.lines_.data(), n);
+            lock.lock();
+            s.record_batch(n, busy_ns);
+        }
+        if (s.ordering_ != concore::stage_ordering::concurrent)
+            s.active_ = false;
+        lock.unlock();
+
+        std::swap(buf, thread_buffer);
+        // The last use of the pipeline by this task; after this, it may be destroyed
+        num_tasks_.fetch_sub(1, std::memory_order_release);
+    }
+
+    //! Called after the last stage; recycles the lines of the finished items, admits the waiting
+    //! items in their place, and accepts the asynchronous pushes that fit now
+    void finish(line** lines, size_t n) {
+        size_t freed_bytes = 0;
+        for (size_t i = 0; i < n; i++) {
+            freed_bytes += lines[i]->bytes_;
+            if (!lines[i]->recycled_) {
+                delete lines[i];
+                lines[i] = nullptr;
+            }
+        }
+        size_t num_admitted = 0;
+        std::vector<line*> extra;
+        std::vector<concore::task> continuations;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (measure_) {
+                record_in_flight_change();
+                end_ns_ = last_in_flight_change_ns_;
+            }
+            in_flight_ -= int(n);
+            items_done_ += n;
+            bytes_ -= freed_bytes;
+            for (size_t i = 0; i < n; i++)
+                if (lines[i])
+                    recycle(lines[i]);
+            if (adaptive_.enabled_) {
+                finished_since_adjust_ += int(n);
+                if (finished_since_adjust_ >= std::max(16, limit_)) {
+                    finished_since_adjust_ = 0;
+                    adjust_limit();
+                }
+            }
+            while (!async_pushes_.empty() && has_room(async_pushes_.front().bytes_)) {
+                auto& p = async_pushes_.front();
+                accept(p.line_, p.bytes_);
+                continuations.push_back(std::move(p.on_accepted_));
+                async_pushes_.pop_front();
+            }
+            num_admitted = admit(lines, n);
+            // After raising the limit, more items can start than the ones that just finished
+            if (in_flight_ < limit_ && !waiting_.empty()) {
+                extra.resize(size_t(limit_ - in_flight_));
+                extra.resize(admit(extra.data(), extra.size()));
+            }
+        }
+        room_available_.notify_all();
+        if (num_admitted > 0)
+            enqueue(0, lines, num_admitted);
+        if (!extra.empty())
+            enqueue(0, extra.data(), extra.size());
+        for (auto& t : continuations)
+            concore::spawn(std::move(t));
+    }
+
+    //! Called with the lock held; sets the limit of items in flight from the service times of
+    //! the stages, with Little's law
+    void adjust_limit() {
+        double latency_ns = 0;
+        double slowest_serial_ns = 0;
+        for (auto& s : stages_) {
+            double service_ns = s->update_service_time();
+            latency_ns += service_ns;
+            if (s->ordering_ != concore::stage_ordering::concurrent)
+                slowest_serial_ns = std::max(slowest_serial_ns, service_ns);
+        }
+        if (latency_ns <= 0)
+            return;
+        // The time between two items leaving the pipeline, at best
+        double interval_ns = std::max(slowest_serial_ns, latency_ns / adaptive_.num_workers_);
+        double needed = latency_ns / interval_ns * adaptive_.headroom_;
+        int limit = int(std::ceil(needed));
+        limit_ = std::min(max_concurrency_, std::max(adaptive_.min_concurrency_, limit));
+    }
+};
+
+} // namespace detail
+
+template <typename T>
+class batched_pipeline;
+
+//! An item from the pool of a pipeline, filled in place by the producer before pushing it; see
+//! `batched_pipeline::acquire()`. If destroyed without being pushed, it goes back to the pool.
+template <typename T>
+class pipeline_slot {
+public:
+    pipeline_slot(pipeline_slot&& other) noexcept
+        : owner_(other.owner_)
+        , line_(std::exchange(other.line_, nullptr)) {}
+    pipeline_slot& operator=(pipeline_slot&& other) noexcept {
+        if (this != &other) {
+            reset();
+            owner_ = other.owner_;
+            line_ = std::exchange(other.line_, nullptr);
+        }
+        return *this;
+    }
+    ~pipeline_slot() { reset(); }
+
+    T& operator*() const { return line_->data_; }
+    T* operator->() const { return &line_->data_; }
+    T* get() const { return line_ ? &line_->data_ : nullptr; }
+    explicit operator bool() const { return line_ != nullptr; }
+
+private:
+    friend class batched_pipeline<T>;
+
+    detail::pipeline_impl<T>* owner_;
+    detail::pipeline_line<T>* line_;
+
+    pipeline_slot(detail::pipeline_impl<T>* owner, detail::pipeline_line<T>* l)
+        : owner_(owner)
+        , line_(l) {}
+
+    //! Gives the line of the slot to the pipeline
+    detail::pipeline_line<T>* release() {
+        assert(line_);
+        return std::exchange(line_, nullptr);
+    }
+
+    void reset() {
+        if (line_)
+            owner_->release_line(std::exchange(line_, nullptr));
+    }
+};
+
+//! A pipeline with batched stages; see `batched_pipeline_builder`
+template <typename T>
+class batched_pipeline {
+public:
+    explicit batched_pipeline(std::shared_ptr<detail::pipeline_impl<T>> impl)
+        : impl_(std::move(impl)) {}
+
+    //! Pushes an item through the pipeline; to know when it's done, wait on the task group given
+    //! to the builder. Blocks while the pipeline is full.
+    void push(T item) { impl_->push(std::move(item)); }
+
+    //! Pushes the item if the pipeline is not full; otherwise returns false, and `item` is left
+    //! untouched
+    bool try_push(T&& item) { return impl_->try_push(std::move(item)); }
+
+    //! Pushes the item, and spawns `on_accepted` when the pipeline has accepted it; never blocks.
+    //! While the pipeline is full, the item is kept aside.
+    void push_async(T item, concore::task on_accepted) {
+        impl_->push_async(std::move(item), std::move(on_accepted));
+    }
+
+    //! Returns a slot from the pool of items; a default-constructed item if the pool is empty,
+    //! otherwise an item that went through the pipeline before. Doesn't block.
+    pipeline_slot<T> acquire() { return pipeline_slot<T>{impl_.get(), impl_->acquire_line()}; }
+
+    //! Pushes the item of the slot; after the last stage, it goes back to the pool. Blocks while
+    //! the pipeline is full.
+    void push(pipeline_slot<T> slot) { impl_->push(take(slot)); }
+
+    //! Pushes the item of the slot if the pipeline is not full; otherwise returns false, and the
+    //! slot is left untouched
+    bool try_push(pipeline_slot<T>&& slot) {
+        assert(slot.owner_ == impl_.get() && slot.line_);
+        if (!impl_->try_push(slot.line_))
+            return false;
+        slot.release();
+        return true;
+    }
+
+    //! Pushes the item of the slot, as `push_async` above
+    void push_async(pipeline_slot<T> slot, concore::task on_accepted) {
+        impl_->push_async(take(slot), std::move(on_accepted));
+    }
+
+    //! The measurements so far; empty unless the builder called `collect_stats()`. Call it after
+    //! waiting for the items, to get the statistics of the whole run.
+    pipeline_stats stats() const { return impl_->stats(); }
+
+    //! The current limit of items in flight: `max_concurrency`, unless adaptive
+    int concurrency_limit() const { return impl_->concurrency_limit(); }
+
+private:
+    std::shared_ptr<detail::pipeline_impl<T>> impl_;
+
+    //! Takes the line of a slot acquired from this pipeline
+    detail::pipeline_line<T>* take(pipeline_slot<T>& slot) {
+        assert(slot.owner_ == impl_.get());
+        return slot.release();
+    }
+};
+
+//! Builds a `batched_pipeline`, with the functions called for items of type `T`
+template <typename T>
+class batched_pipeline_builder {
+public:
+    explicit batched_pipeline_builder(int max_concurrency, concore::task_group grp = {})
+        : max_concurrency_(max_concurrency)
+        , grp_(std::move(grp)) {
+        assert(max_concurrency > 0);
+    }
+
+    //! Adds a stage that processes one item at a time
+    batched_pipeline_builder& add_stage(
+            concore::stage_ordering ordering, std::function<void(T&)> f, std::string name = {}) {
+        auto per_item = [f = std::move(f)](item_span<T> items) {
+            for (auto& item : items)
+                f(item);
+        };
+        return add_batch_stage(ordering, 1, std::move(per_item), std::move(name));
+    }
+
+    //! Adds a stage that processes batches of up to `batch_size` items
+    batched_pipeline_builder& add_batch_stage(concore::stage_ordering ordering, size_t batch_size,
+            std::function<void(item_span<T>)> f, std::string name = {}) {
+        assert(batch_size > 0);
+        if (name.empty())
+            name = "stage " + std::to_string(stages_.size());
+        stages_.push_back(std::make_unique<detail::pipeline_stage<T>>(
+                ordering, batch_size, std::move(f), std::move(name), max_concurrency_));
+        return *this;
+    }
+
+    //! Limits the number of items waiting to enter the pipeline (beyond `max_concurrency`)
+    batched_pipeline_builder& queue_capacity(size_t n) {
+        limits_.queue_capacity_ = n;
+        return *this;
+    }
+
+    //! Limits the memory of the items in the pipeline; `item_size` gives the size of an item
+    batched_pipeline_builder& memory_budget(
+            size_t bytes, std::function<size_t(const T&)> item_size) {
+        limits_.memory_budget_ = bytes;
+        limits_.item_size_ = std::move(item_size);
+        return *this;
+    }
+
+    //! Makes the pipeline adjust its limit of items in flight, between `min_concurrency` and
+    //! `max_concurrency`, from the measured service times of the stages. `num_workers` is the
+    //! number of threads executing the stages (0 for the number of hardware threads).
+    batched_pipeline_builder& adaptive_concurrency(
+            int min_concurrency = 1, int num_workers = 0, double headroom = 1.5) {
+        if (num_workers <= 0)
+            num_workers = int(std::max(1u, std::thread::hardware_concurrency()));
+        adaptive_.enabled_ = true;
+        adaptive_.min_concurrency_ = std::max(1, min_concurrency);
+        adaptive_.num_workers_ = num_workers;
+        adaptive_.headroom_ = headroom;
+        return *this;
+    }
+
+    //! Makes the pipeline measure its stages; see `batched_pipeline::stats()`
+    batched_pipeline_builder& collect_stats() {
+        measure_ = true;
+        return *this;
+    }
+
+    batched_pipeline<T> build() {
+        assert(!stages_.empty());
+        auto impl = std::make_shared<detail::pipeline_impl<T>>(max_concurrency_, grp_,
+                std::move(stages_), std::move(limits_), adaptive_, measure_);
+        return batched_pipeline<T>{std::move(impl)};
+    }
+
+    //! Sets the ordering of the stages added after this
+    batched_pipeline_builder& operator|(concore::stage_ordering ordering) {
+        ordering_ = ordering;
+        return *this;
+    }
+    template <typename F>
+    batched_pipeline_builder& operator|(batch_stage_fun<F> s) {
+        return add_batch_stage(ordering_, s.batch_size_, std::move(s.fun_));
+    }
+    template <typename F>
+    batched_pipeline_builder& operator|(F f) {
+        return add_stage(ordering_, std::move(f));
+    }
+    template <typename F>
+    batched_pipeline_builder& operator|(named_stage_fun<batch_stage_fun<F>> s) {
+        return add_batch_stage(
+                ordering_, s.fun_.batch_size_, std::move(s.fun_.fun_), std::move(s.name_));
+    }
+    template <typename F>
+    batched_pipeline_builder& operator|(named_stage_fun<F> s) {
+        return add_stage(ordering_, std::move(s.fun_), std::move(s.name_));
+    }
+    batched_pipeline<T> operator|(concore::pipeline_end_t) { return build(); }
+
+private:
+    int max_concurrency_;
+    concore::task_group grp_;
+    concore::stage_ordering ordering_{concore::stage_ordering::in_order};
+    std::vector<std::unique_ptr<detail::pipeline_stage<T>>> stages_;
+    detail::pipeline_limits<T> limits_;
+    detail::pipeline_adaptive_settings adaptive_;
+    bool measure_{false};
+};
+
+//! Prints the measurements of the stages of a pipeline, and, for the text format, names the
+//! bottleneck stage
+inline void print_pipeline_report(
+        const pipeline_stats& st, output_format fmt = output_format::text, FILE* f = stdout) {
+    results_table table{{"stage", "ordering", "items", "batches", "busy_ms", "service_us",
+            "mean_busy", "utilization", "mean_queue", "max_queue", "reorder_wait_us"}};
+    for (const auto& s : st.stages_) {
+        table.row()
+                .add(s.name_)
+                .add(stage_ordering_name(s.ordering_))
+                .add(double(s.items_))
+                .add(double(s.batches_))
+                .add(s.busy_ms_)
+                .add(s.service_us_)
+                .add(s.mean_busy_)
+                .add(s.utilization_)
+                .add(s.mean_queue_)
+                .add(double(s.max_queue_))
+                .add(s.reorder_wait_us_);
+    }
+    table.print(fmt, f);
+    if (fmt != output_format::text)
+        return;
+    fprintf(f, "%llu items in %.1fms; in flight: %.1f on average, %d at most (limit %d of %d)\n",
+            (unsigned long long)st.items_, st.elapsed_ms_, st.mean_in_flight_, st.max_in_flight_,
+            st.concurrency_limit_, st.max_concurrency_);
+    if (st.bottleneck_ >= 0) {
+        const auto& b = st.stages_[st.bottleneck_];
+        fprintf(f, "bottleneck: %s (%s), utilization %.0f%%\n", b.name_.c_str(),
+                stage_ordering_name(b.ordering_), b.utilization_ * 100);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+//! Registry of benchmark scenarios.
+//!
+//! Each example in `performance/` registers its scenarios here, with a static `bench_registrar`.
+//! The examples keep their own `main`, unless they are compiled with BENCH_DRIVER, in which case
+//! they are linked together with the benchmark driver (`performance/bench.cpp`), which runs
+//! the scenarios selected on the command line.
+//!
+//! A scenario declares its parameters, with default values; the driver can override them. Each
+//! repetition of a scenario is timed by the driver, and the scenario can add its own metrics.
+
+#include "affinity.hpp"
+#include "profiling.hpp"
+
+#include <concore/init.hpp>
+
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+
+//! The parameters of a scenario, with their current values
+class bench_params {
+public:
+    bench_params() = default;
+    bench_params(std::vector<std::pair<std::string, double>> values)
+        : values_(std::move(values)) {}
+
+    double get(const char* name) const {
+        for (const auto& p : values_)
+            if (p.first == name)
+                return p.second;
+        fprintf(stderr, "bench: unknown parameter '%s'\n", name);
+        abort();
+    }
+    int get_int(const char* name) const { return int(get(name)); }
+
+    //! Changes the value of the given parameter; returns false if there is no such parameter
+    bool set(const std::string& name, double value) {
+        for (auto& p : values_)
+            if (p.first == name) {
+                p.second = value;
+                return true;
+            }
+        return false;
+    }
+
+    const std::vector<std::pair<std::string, double>>& values() const { return values_; }
+
+    //! Returns the parameters in the form `name1=val1 name2=val2`
+    std::string to_string() const {
+        std::string res;
+        char buf[64];
+        for (const auto& p : values_) {
+            snprintf(buf, sizeof(buf), "%s%s=%g", res.empty() ? "" : " ", p.first.c_str(),
+                    p.second);
+            res += buf;
+        }
+        return res;
+    }
+
+private:
+    std::vector<std::pair<std::string, double>> values_;
+};
+
+//! Metrics reported by one repetition of a scenario, besides the elapsed time
+class bench_metrics {
+public:
+    void add(std::string name, double value) { values_.emplace_back(std::move(name), value); }
+
+    const std::vector<std::pair<std::string, double>>& values() const { return values_; }
+
+private:
+    std::vector<std::pair<std::string, double>> values_;
+};
+
+//! A benchmark scenario
+struct bench_scenario {
+    std::string name_;
+    std::string description_;
+    //! The parameters of the scenario, with their default values
+    bench_params params_;
+    //! Called once before the repetitions of the scenario (e.g., to initialize concore)
+    std::function<void(const bench_params&)> setup_;
+    //! Runs one repetition of the scenario
+    std::function<void(const bench_params&, bench_metrics&)> run_;
+};
+
+//! Returns all the registered scenarios
+inline std::vector<bench_scenario>& bench_scenarios() {
+    static std::vector<bench_scenario> instance;
+    return instance;
+}
+
+//! Registers a scenario at static initialization time
+struct bench_registrar {
+    explicit bench_registrar(bench_scenario s) { bench_scenarios().push_back(std::move(s)); }
+};
+
+//! (Re)initializes concore with the given number of workers (0 = hardware concurrency)
+inline void set_num_workers(int count, const placement_config& placement = {}) {
+    CONCORE_PROFILING_FUNCTION();
+    concore::shutdown();
+    concore::init_data config;
+    config.num_workers_ = count;
+    apply_placement(config, placement);
+    concore::init(config);
+}
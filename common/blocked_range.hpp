@@ -0,0 +1,236 @@
+#pragma once
+
+//! Multidimensional blocked ranges for `conc_for`.
+//!
+//! The range is split into tiles of a given shape, and `conc_for` runs over the tiles. The tiles
+//! can be visited in row-major order, or along a Morton (Z-order) or Hilbert curve. `conc_for`
+//! gives contiguous runs of tiles to the same worker; with the space-filling curves, such a run is
+//! a compact region instead of a thin strip, so a worker keeps reusing the data it just loaded.
+
+#include "profiling.hpp"
+
+#include <concore/conc_for.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+//! The order in which we visit the tiles
+enum class tile_order {
+    row_major, //!< The last dimension varies fastest
+    morton,    //!< Z-order curve; cheap to compute, mostly local
+    hilbert,   //!< Hilbert curve; consecutive tiles are adjacent if the grid is a power of two
+};
+
+//! A tile: the indices in [begin_[d], end_[d]) for each dimension `d`
+template <int N>
+struct tile {
+    std::array<int, N> begin_;
+    std::array<int, N> end_;
+};
+
+//! A range of N-dimensional indices, split into tiles of `tile_size_` (the last tiles can be
+//! smaller). Dimension 0 is the slowest varying one (rows, for 2D).
+template <int N>
+struct blocked_range {
+    std::array<int, N> begin_;
+    std::array<int, N> end_;
+    std::array<int, N> tile_size_;
+
+    //! The number of tiles along dimension `d`
+    int num_tiles(int d) const {
+        return std::max(0, (end_[d] - begin_[d] + tile_size_[d] - 1) / tile_size_[d]);
+    }
+
+    //! Returns the tile with the given coordinates (in tiles)
+    tile<N> get_tile(const std::array<int, N>& coords) const {
+        tile<N> res;
+        for (int d = 0; d < N; d++) {
+            res.begin_[d] = begin_[d] + coords[d] * tile_size_[d];
+            res.end_[d] = std::min(end_[d], res.begin_[d] + tile_size_[d]);
+        }
+        return res;
+    }
+};
+
+using tile2d = tile<2>;
+using tile3d = tile<3>;
+using range2d = blocked_range<2>;
+using range3d = blocked_range<3>;
+
+namespace detail {
+
+//! Spreads the bits of `index` over N coordinates of `bits` bits each: bit `k*N + (N-1-d)` of the
+//! index becomes bit `k` of coordinate `d`. This is the decoding of a Morton code, with dimension
+//! 0 taking the most significant bit of each group.
+template <int N>
+std::array<uint32_t, N> deinterleave_bits(uint64_t index, int bits) {
+    std::array<uint32_t, N> res{};
+    for (int k = 0; k < bits; k++)
+        for (int d = 0; d < N; d++)
+            res[d] |= uint32_t((index >> (k * N + (N - 1 - d))) & 1) << k;
+    return res;
+}
+
+//! Converts a Hilbert index, given in the "transposed" form produced by `deinterleave_bits`, into
+//! coordinates. Works for any number of dimensions.
+//! J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707, 381 (2004).
+template <int N>
+void hilbert_transpose_to_axes(std::array<uint32_t, N>& x, int bits) {
+    if (bits == 0)
+        return;
+    uint32_t top = uint32_t(2) << (bits - 1);
+    // Gray decode
+    uint32_t t = x[N - 1] >> 1;
+    for (int i = N - 1; i > 0; i--)
+        x[i] ^= x[i - 1];
+    x[0] ^= t;
+    // Undo the excess work
+    for (uint32_t q = 2; q != top; q <<= 1) {
+        uint32_t p = q - 1;
+        for (int i = N - 1; i >= 0; i--) {
+            if (x[i] & q)
+                x[0] ^= p; // invert
+            else {
+                t = (x[0] ^ x[i]) & p; // exchange
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+}
+
+//! Returns the point of the curve with the given index, on a grid of `bits` bits per dimension
+template <int N>
+std::array<uint32_t, N> curve_point(uint64_t index, int bits, tile_order order) {
+    auto x = deinterleave_bits<N>(index, bits);
+    if (order == tile_order::hilbert)
+        hilbert_transpose_to_axes<N>(x, bits);
+    return x;
+}
+
+//! Appends the points of the curve with indices in [first, first + 2^(N*level)) that are inside
+//! the grid of tiles. On both curves, these points fill an aligned cube of side 2^level; we only
+//! descend into the cubes that overlap the grid, so the cost is proportional to the number of
+//! tiles, not to the size of the power-of-two grid.
+template <int N>
+void append_curve_block(uint64_t first, int level, int bits, tile_order order,
+        const std::array<int, N>& num_tiles, std::vector<std::array<int, N>>& out) {
+    auto x = curve_point<N>(first, bits, order);
+    uint32_t mask = ~((uint32_t(1) << level) - 1);
+    for (int d = 0; d < N; d++)
+        if ((x[d] & mask) >= uint32_t(num_tiles[d]))
+            return;
+    if (level == 0) {
+        std::array<int, N> coords;
+        for (int d = 0; d < N; d++)
+            coords[d] = int(x[d]);
+        out.push_back(coords);
+        return;
+    }
+    uint64_t step = uint64_t(1) << (N * (level - 1));
+    for (uint64_t c = 0; c < (uint64_t(1) << N); c++)
+        append_curve_block<N>(first + c * step, level - 1, bits, order, num_tiles, out);
+}
+
+} // namespace detail
+
+//! Returns the coordinates of the tiles, in the order in which they should be visited.
+//! For the curves, we walk a power-of-two grid that covers all the tiles, skipping the parts
+//! that are outside our grid.
+template <int N>
+std::vector<std::array<int, N>> tile_traversal(
+        const std::array<int, N>& num_tiles, tile_order order) {
+    std::vector<std::array<int, N>> res;
+    uint64_t total = 1;
+    for (int d = 0; d < N; d++)
+        total *= uint64_t(std::max(0, num_tiles[d]));
+    if (total == 0)
+        return res;
+    res.reserve(size_t(total));
+
+    if (order == tile_order::row_major) {
+        std::array<int, N> coords{};
+        for (uint64_t i = 0; i < total; i++) {
+            res.push_back(coords);
+            for (int d = N - 1; d >= 0; d--) {
+                if (++coords[d] < num_tiles[d])
+                    break;
+                coords[d] = 0;
+            }
+        }
+        return res;
+    }
+
+    int bits = 0;
+    while ((1 << bits) < *std::max_element(num_tiles.begin(), num_tiles.end()))
+        bits++;
+    detail::append_curve_block<N>(0, bits, bits, order, num_tiles, res);
+    return res;
+}
+
+//! Returns the traversal of `tile_traversal`, computed only once for each grid shape and order
+template <int N>
+std::shared_ptr<const std::vector<std::array<int, N>>> cached_tile_traversal(
+        const std::array<int, N>& num_tiles, tile_order order) {
+    using traversal = std::vector<std::array<int, N>>;
+    using key = std::pair<std::array<int, N>, tile_order>;
+    static std::mutex mutex;
+    static std::map<key, std::shared_ptr<const traversal>> cache;
+    // Don't keep the traversals of too many shapes alive
+    constexpr size_t max_shapes = 16;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    auto it = cache.find(key{num_tiles, order});
+    if (it != cache.end())
+        return it->second;
+    if (cache.size() >= max_shapes)
+        cache.clear();
+    auto res = std::make_shared<const traversal>(tile_traversal<N>(num_tiles, order));
+    cache.emplace(key{num_tiles, order}, res);
+    return res;
+}
+
+//! Calls `f(tile)` for all the tiles of the range, in parallel.
+//! Consecutive tiles in the given order tend to be executed by the same worker.
+template <int N, typename F>
+void conc_for_tiles(const blocked_range<N>& r, F&& f, tile_order order = tile_order::row_major) {
+    CONCORE_PROFILING_FUNCTION();
+    std::array<int, N> num_tiles;
+    for (int d = 0; d < N; d++)
+        num_tiles[d] = r.num_tiles(d);
+    auto tiles = cached_tile_traversal<N>(num_tiles, order);
+    concore::conc_for(0, int(tiles->size()), [&](int i) { f(r.get_tile((*tiles)[i])); });
+}
+
+//! Calls `f(i, j)` for all the indices of the 2D range, in parallel, tile by tile
+template <typename F>
+void conc_for_2d(const range2d& r, F&& f, tile_order order = tile_order::row_major) {
+    conc_for_tiles(
+            r,
+            [&](const tile2d& t) {
+                for (int i = t.begin_[0]; i < t.end_[0]; i++)
+                    for (int j = t.begin_[1]; j < t.end_[1]; j++)
+                        f(i, j);
+            },
+            order);
+}
+
+//! Calls `f(i, j, k)` for all the indices of the 3D range, in parallel, tile by tile
+template <typename F>
+void conc_for_3d(const range3d& r, F&& f, tile_order order = tile_order::row_major) {
+    conc_for_tiles(
+            r,
+            [&](const tile3d& t) {
+                for (int i = t.begin_[0]; i < t.end_[0]; i++)
+                    for (int j = t.begin_[1]; j < t.end_[1]; j++)
+                        for (int k = t.begin_[2]; k < t.end_[2]; k++)
+                            f(i, j, k);
+            },
+            order);
+}
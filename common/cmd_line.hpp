@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+//! Very small command-line parser.
+//! Accepts positional arguments and options of the form `--name value` or `--name=value`.
+//! Options without a value (followed by another option, or last) are treated as flags.
+class cmd_line {
+public:
+    cmd_line(int argc, char** argv) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                positional_.push_back(std::move(arg));
+                continue;
+            }
+            arg = arg.substr(2);
+            auto eq = arg.find('=');
+            if (eq != std::string::npos)
+                options_.push_back({arg.substr(0, eq), arg.substr(eq + 1)});
+            else if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0)
+                options_.push_back({arg, argv[++i]});
+            else
+                options_.push_back({arg, ""});
+        }
+    }
+
+    //! Checks if the given option was specified (with or without a value)
+    bool has(const char* name) const { return find(name) != nullptr; }
+
+    //! Returns the value of the given option, or the default value if not specified
+    std::string get(const char* name, const std::string& def = {}) const {
+        auto* opt = find(name);
+        return opt ? opt->value_ : def;
+    }
+    int get_int(const char* name, int def) const {
+        auto* opt = find(name);
+        return opt && !opt->value_.empty() ? std::atoi(opt->value_.c_str()) : def;
+    }
+    double get_double(const char* name, double def) const {
+        auto* opt = find(name);
+        return opt && !opt->value_.empty() ? std::atof(opt->value_.c_str()) : def;
+    }
+
+    //! Returns the list of comma-separated integers given for the option
+    std::vector<int> get_int_list(const char* name) const {
+        std::vector<int> res;
+        std::string val = get(name);
+        size_t start = 0;
+        while (start < val.size()) {
+            size_t end = val.find(',', start);
+            if (end == std::string::npos)
+                end = val.size();
+            if (end > start)
+                res.push_back(std::atoi(val.substr(start, end - start).c_str()));
+            start = end + 1;
+        }
+        return res;
+    }
+
+    //! Returns the values of all the occurrences of the given option, in order
+    std::vector<std::string> get_all(const char* name) const {
+        std::vector<std::string> res;
+        for (const auto& opt : options_)
+            if (opt.name_ == name)
+                res.push_back(opt.value_);
+        return res;
+    }
+
+    //! The positional arguments (the ones that do not start with `--`)
+    const std::vector<std::string>& positional() const { return positional_; }
+
+private:
+    struct option {
+        std::string name_;
+        std::string value_;
+    };
+    std::vector<std::string> positional_;
+    std::vector<option> options_;
+
+    const option* find(const char* name) const {
+        // Last occurrence wins
+        for (auto it = options_.rbegin(); it != options_.rend(); ++it)
+            if (it->name_ == name)
+                return &*it;
+        return nullptr;
+    }
+};
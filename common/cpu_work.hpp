@@ -2,6 +2,13 @@
 
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+//! Prevents the compiler from optimizing away the computation of the given value
+inline void do_not_optimize(uint64_t& val) { asm volatile("" : "+r"(val)); }
+
 inline void cpu_busy_work_unit() {
     uint64_t a = 0;
     uint64_t b = 1;
@@ -9,6 +16,7 @@ inline void cpu_busy_work_unit() {
         auto sum = a + b;
         a = b;
         b = sum;
+        do_not_optimize(b);
     }
 }
 
@@ -17,11 +25,71 @@ inline void cpu_busy_work_large_unit() {
         cpu_busy_work_unit();
 }
 
+//! Fine-grained busy work; an iteration is much cheaper than a work unit.
+//! The empty asm statement prevents the compiler from removing the loop.
+inline void cpu_busy_spin(int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++)
+        asm volatile("" ::: "memory");
+}
+
+//! The measured costs of our work primitives, on this machine, with this build
+struct cpu_work_calibration {
+    double ns_per_unit_{0};      //!< Cost of one `cpu_busy_work_unit` call
+    double ns_per_iteration_{0}; //!< Cost of one `cpu_busy_spin` iteration
+};
+
+namespace detail {
+//! Measures the time needed for the given work, in ns; returns the best of a few runs.
+//! The best run is the one least disturbed by interrupts and other processes.
+template <typename F>
+inline double best_time_ns(F&& f) {
+    using clock = std::chrono::steady_clock;
+    f(); // warm-up
+    double best = 1e30;
+    for (int i = 0; i < 7; i++) {
+        auto start = clock::now();
+        f();
+        auto end = clock::now();
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    return best;
+}
+} // namespace detail
+
+//! Calibrates the work primitives, measuring how much they cost on this machine.
+//! The calibration is done only once, at the first call; call this at startup, before measuring
+//! anything, so that the calibration does not interfere with the measurements.
+inline const cpu_work_calibration& calibrate_cpu_work() {
+    static const cpu_work_calibration calib = [] {
+        constexpr int num_units = 20'000;
+        constexpr int64_t num_iterations = 5'000'000;
+        cpu_work_calibration res;
+        res.ns_per_unit_ = detail::best_time_ns([] {
+            for (int i = 0; i < num_units; i++)
+                cpu_busy_work_unit();
+        }) / num_units;
+        res.ns_per_iteration_ =
+                detail::best_time_ns([] { cpu_busy_spin(num_iterations); }) / double(num_iterations);
+        return res;
+    }();
+    return calib;
+}
+
+//! Performs `count` work units
+inline void do_work_units(int64_t count) {
+    for (int64_t i = 0; i < count; i++)
+        cpu_busy_work_unit();
+}
+
+//! Performs busy work that takes (approximately) the given number of nanoseconds.
+//! Uses the calibration data, so there is no clock polling while working; the amount of work is
+//! fixed, even if the thread gets preempted.
+inline void do_work_ns(double ns) {
+    const auto& calib = calibrate_cpu_work();
+    cpu_busy_spin(int64_t(std::llround(ns / calib.ns_per_iteration_)));
+}
+
 template <typename Rep, typename Period>
 inline void do_work_for(const std::chrono::duration<Rep, Period>& dur) {
-    using clock = std::chrono::high_resolution_clock;
-    auto stopTime = clock::now() + dur;
-    do {
-        cpu_busy_work_unit();
-    } while (clock::now() < stopTime);
-}
\ No newline at end of file
+    do_work_ns(std::chrono::duration<double, std::nano>(dur).count());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+//! Fork-join without heap allocations.
+//!
+//! `spawn_and_wait({...})` copies the functions into `std::function` objects (allocating whenever
+//! the captures don't fit the small buffer) and creates a task group; `task_group::create()`
+//! allocates too. Recursive algorithms do this at every split.
+//!
+//! Here, the functions to fork stay on the stack of the caller; the spawned tasks only capture a
+//! pointer to them, which fits in the small buffer of `std::function`. Instead of creating a new
+//! task group for every fork, each thread keeps a stack of task groups, one per fork nesting level
+//! on that thread, and reuses them. After a thread reaches a given nesting depth once, forks at
+//! that depth don't allocate anymore.
+
+#include "profiling.hpp"
+
+#include <concore/spawn.hpp>
+
+#include <utility>
+#include <vector>
+
+namespace detail {
+
+//! The task groups used by the forks of the current thread, one per nesting level
+struct fork_join_groups {
+    std::vector<concore::task_group> groups_;
+    int depth_{0};
+};
+
+inline fork_join_groups& this_thread_fork_join_groups() {
+    thread_local fork_join_groups instance;
+    return instance;
+}
+
+//! Takes the task group for the next nesting level of the current thread, for the lifetime of
+//! the object. Nesting levels on a thread are strictly LIFO, so a group is never used by two
+//! forks at the same time.
+class fork_join_level {
+public:
+    fork_join_level()
+        : data_(this_thread_fork_join_groups()) {
+        if (data_.depth_ == int(data_.groups_.size()))
+            data_.groups_.push_back(concore::task_group::create());
+        grp_ = data_.groups_[data_.depth_++];
+    }
+    ~fork_join_level() { data_.depth_--; }
+    fork_join_level(const fork_join_level&) = delete;
+    fork_join_level& operator=(const fork_join_level&) = delete;
+
+    concore::task_group& group() { return grp_; }
+
+private:
+    fork_join_groups& data_;
+    concore::task_group grp_;
+};
+
+template <typename F>
+void spawn_by_ref(F& f, concore::task_group& grp) {
+    F* pf = &f;
+    concore::spawn(concore::task{[pf] { (*pf)(); }, grp});
+}
+
+} // namespace detail
+
+//! Executes the given functions in parallel, and returns when all of them are done.
+//! The first function is executed by the calling thread; the others are spawned. While waiting,
+//! the calling thread helps executing tasks. Does not allocate memory, after the first fork at
+//! each nesting level on each thread.
+template <typename F, typename... Fs>
+void fork_join(F&& f, Fs&&... fs) {
+    CONCORE_PROFILING_FUNCTION();
+    detail::fork_join_level level;
+    (detail::spawn_by_ref(fs, level.group()), ...);
+    // The spawned tasks refer to our stack; wait for them even if `f` throws
+    try {
+        f();
+    } catch (...) {
+        concore::wait(level.group());
+        throw;
+    }
+    concore::wait(level.group());
+}
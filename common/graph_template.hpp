@@ -0,0 +1,479 @@
+#pragma once
+
+//! Task graphs defined once, and instantiated many times.
+//!
+//! Building a graph of `chained_task` objects for every request allocates every node, every edge
+//! and every closure. A `graph_template` holds the topology (the nodes, their functions and the
+//! edges) once; a `graph_instance` only holds the state of one execution: a context object, and
+//! one dependency counter per node. Instances are kept in a `graph_pool`; starting an instance
+//! resets its counters from the template, without allocating anything.
+//!
+//! The node functions receive the context of the instance, which replaces the data captured by
+//! the closures of a hand-built graph. Node functions should not throw.
+//!
+//! Scheduling: by default, ready nodes are simply spawned (`graph_schedule::fifo`). With
+//! `graph_schedule::critical_path`, ready nodes go to a priority queue shared by all the instances
+//! of the pool, and each spawned task runs the ready node with the longest remaining critical path
+//! (the node's cost plus the longest chain of costs after it). Nodes that determine the latency of
+//! their graph run before nodes that can wait, like logging or statistics. Across instances, the
+//! ones started earlier go first, so that starting new graphs doesn't delay the ones in progress.
+//!
+//! The costs come from annotations on the template, or from the average durations measured by the
+//! pool. When measuring, the pool also reports the makespan of each graph (from `start()` to the
+//! end of its last node) against its critical path, computed with the measured durations of the
+//! same execution: the makespan cannot be shorter than that.
+
+#include "profiling.hpp"
+#include "latency_histogram.hpp"
+
+#include <concore/spawn.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <typename Ctx>
+class graph_pool;
+
+//! The topology of a task graph, whose nodes work on a context of type `Ctx`
+template <typename Ctx>
+class graph_template {
+public:
+    using node_id = int;
+    using node_fun = std::function<void(Ctx&)>;
+
+    //! Adds a node that will call `f(context)`; returns its id. The cost is an estimate of the
+    //! duration of the node, in any unit; it's only used to find the critical path.
+    node_id add_node(std::string name, node_fun f, double cost = 1.0) {
+        nodes_.push_back({std::move(name), std::move(f), cost, 0, {}});
+        return node_id(nodes_.size() - 1);
+    }
+
+    //! Makes `to` start only after `from` is done
+    void add_edge(node_id from, node_id to) {
+        assert(from != to);
+        nodes_[from].successors_.push_back(to);
+        nodes_[to].num_predecessors_++;
+    }
+    void add_edges(node_id from, std::initializer_list<node_id> to) {
+        for (auto t : to)
+            add_edge(from, t);
+    }
+    void add_edges(std::initializer_list<node_id> from, node_id to) {
+        for (auto f : from)
+            add_edge(f, to);
+    }
+
+    void set_cost(node_id n, double cost) { nodes_[n].cost_ = cost; }
+
+    int num_nodes() const { return int(nodes_.size()); }
+    const std::string& name(node_id n) const { return nodes_[n].name_; }
+    double cost(node_id n) const { return nodes_[n].cost_; }
+    const std::vector<node_id>& successors(node_id n) const { return nodes_[n].successors_; }
+    int num_predecessors(node_id n) const { return nodes_[n].num_predecessors_; }
+
+    //! Returns the nodes in an order in which every node comes after its predecessors
+    std::vector<node_id> topological_order() const {
+        std::vector<node_id> res;
+        res.reserve(nodes_.size());
+        std::vector<int> preds(nodes_.size());
+        for (size_t i = 0; i < nodes_.size(); i++) {
+            preds[i] = nodes_[i].num_predecessors_;
+            if (preds[i] == 0)
+                res.push_back(node_id(i));
+        }
+        for (size_t i = 0; i < res.size(); i++)
+            for (auto s : nodes_[res[i]].successors_)
+                if (--preds[s] == 0)
+                    res.push_back(s);
+        assert(res.size() == nodes_.size()); // no cycles
+        return res;
+    }
+
+    //! For each node, the length of the longest path that starts with it, given the cost of each
+    //! node (`cost(n)`), and the topological order. Fills `out` and returns the longest path
+    //! overall (the critical path).
+    template <typename Cost>
+    double remaining_path_lengths(
+            const std::vector<node_id>& order, Cost&& cost, double* out) const {
+        double res = 0;
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            double after = 0;
+            for (auto s : nodes_[*it].successors_)
+                after = std::max(after, out[s]);
+            out[*it] = cost(*it) + after;
+            res = std::max(res, out[*it]);
+        }
+        return res;
+    }
+
+private:
+    template <typename>
+    friend class graph_instance;
+
+    struct node {
+        std::string name_;
+        node_fun fun_;
+        double cost_;
+        int num_predecessors_;
+        std::vector<node_id> successors_;
+    };
+    std::vector<node> nodes_;
+};
+
+//! How the instances of a pool pick the next node to run
+enum class graph_schedule {
+    fifo,          //!< spawn the nodes as they become ready
+    critical_path, //!< run the ready node with the longest remaining critical path first
+};
+
+//! Options for a `graph_pool`
+struct graph_pool_options {
+    graph_schedule schedule_{graph_schedule::fifo};
+    //! Measure the duration of the nodes and the makespan of the graphs
+    bool measure_{false};
+};
+
+//! Makespan of the graphs, compared to their critical path
+struct graph_timing_stats {
+    int count_{0};
+    double mean_makespan_us_{0};
+    double mean_critical_path_us_{0};
+    //! makespan / critical path; 1 means that the graph finished as early as possible
+    double mean_ratio_{0};
+    double max_ratio_{0};
+};
+
+//! One execution of a graph template. Obtained from a `graph_pool`; after `start()`, the instance
+//! goes back to the pool by itself, once all its nodes are done.
+template <typename Ctx>
+class graph_instance {
+public:
+    using node_id = typename graph_template<Ctx>::node_id;
+    using clock = std::chrono::steady_clock;
+
+    //! The context passed to all the node functions. Keeps its value from the previous use of the
+    //! instance, so that its buffers can be reused.
+    Ctx& context() { return ctx_; }
+
+    //! Starts executing the graph: resets the dependency counters, and schedules the nodes without
+    //! predecessors. Doesn't allocate.
+    void start() {
+        CONCORE_PROFILING_FUNCTION();
+        const auto& nodes = tmpl_.nodes_;
+        remaining_.store(int(nodes.size()), std::memory_order_relaxed);
+        for (size_t i = 0; i < nodes.size(); i++)
+            counters_[i].store(nodes[i].num_predecessors_, std::memory_order_relaxed);
+        seq_ = pool_.next_seq_.fetch_add(1, std::memory_order_relaxed);
+        if (pool_.options_.measure_)
+            start_time_ = clock::now();
+        // Once we schedule the last root, the instance may finish and be reused at any time; the
+        // loop only looks at the template
+        for (size_t i = 0; i < nodes.size(); i++)
+            if (nodes[i].num_predecessors_ == 0)
+                pool_.schedule(this, node_id(i));
+    }
+
+private:
+    friend class graph_pool<Ctx>;
+
+    const graph_template<Ctx>& tmpl_;
+    graph_pool<Ctx>& pool_;
+    Ctx ctx_{};
+    std::unique_ptr<std::atomic<int>[]> counters_;
+    std::atomic<int> remaining_{0};
+    //! The order in which the instances were started
+    uint64_t seq_{0};
+    // Only used when measuring
+    clock::time_point start_time_;
+    std::unique_ptr<double[]> durations_ns_;
+    std::unique_ptr<double[]> path_lengths_;
+
+    graph_instance(const graph_template<Ctx>& tmpl, graph_pool<Ctx>& pool)
+        : tmpl_(tmpl)
+        , pool_(pool)
+        , counters_(new std::atomic<int>[tmpl.nodes_.size()])
+        , durations_ns_(new double[tmpl.nodes_.size()])
+        , path_lengths_(new double[tmpl.nodes_.size()]) {}
+
+    //! Runs node `n`, and calls `on_ready(s)` for each successor `s` that becomes ready.
+    //! Returns true if this was the last node; the instance is back in the pool at that point.
+    template <typename OnReady>
+    bool execute_node(node_id n, OnReady&& on_ready) {
+        const auto& node = tmpl_.nodes_[n];
+        if (pool_.options_.measure_) {
+            auto t0 = clock::now();
+            node.fun_(ctx_);
+            durations_ns_[n] = std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+        } else
+            node.fun_(ctx_);
+        for (auto s : node.successors_)
+            if (counters_[s].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                on_ready(s);
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            pool_.release(this);
+            return true;
+        }
+        return false;
+    }
+
+    //! FIFO scheduling: spawns the successors that become ready, but continues with the last one
+    //! of them on this thread, to save one spawn along each path
+    void run_fifo(node_id n) {
+        while (n >= 0) {
+            node_id next = -1;
+            bool done = execute_node(n, [&](node_id s) {
+                if (next >= 0)
+                    pool_.spawn_fifo(this, next);
+                next = s;
+            });
+            if (done)
+                return;
+            n = next;
+        }
+    }
+
+    //! The makespan of this execution, and the critical path with the measured durations
+    std::pair<double, double> measure_makespan() {
+        using ns = std::chrono::duration<double, std::nano>;
+        double makespan = ns(clock::now() - start_time_).count();
+        double critical_path = tmpl_.remaining_path_lengths(
+                pool_.order_, [this](node_id n) { return durations_ns_[n]; }, path_lengths_.get());
+        return {makespan, critical_path};
+    }
+};
+
+//! A pool of instances of a graph template. The template must outlive the pool, and must not
+//! change while the pool exists. Destroying the pool waits for the running instances to finish;
+//! so a graph can signal its end from its last node, and the pool can be destroyed right after.
+template <typename Ctx>
+class graph_pool {
+public:
+    using node_id = typename graph_template<Ctx>::node_id;
+
+    explicit graph_pool(
+            const graph_template<Ctx>& tmpl, int initial_size = 0, graph_pool_options options = {})
+        : tmpl_(tmpl)
+        , options_(options)
+        , order_(tmpl.topological_order())
+        , priorities_(tmpl.num_nodes())
+        , node_stats_(new node_stats[tmpl.num_nodes()]) {
+        tmpl_.remaining_path_lengths(
+                order_, [this](node_id n) { return tmpl_.cost(n); }, priorities_.data());
+        for (int i = 0; i < initial_size; i++)
+            free_.push_back(create());
+    }
+    ~graph_pool() {
+        while (size() != num_free())
+            std::this_thread::yield();
+    }
+    graph_pool(const graph_pool&) = delete;
+    graph_pool& operator=(const graph_pool&) = delete;
+
+    //! Returns an instance that is not running; creates a new one only if the pool is empty
+    graph_instance<Ctx>& acquire() {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (!free_.empty()) {
+                auto* res = free_.back();
+                free_.pop_back();
+                return *res;
+            }
+        }
+        return *create();
+    }
+
+    //! The number of instances created so far
+    int size() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return int(all_.size());
+    }
+    //! The number of instances that are not running
+    int num_free() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return int(free_.size());
+    }
+
+    //! The priority of a node with `graph_schedule::critical_path`: its remaining critical path
+    double priority(node_id n) const { return priorities_[n]; }
+
+    //! The average measured duration of the node, in ns (0 if not measured)
+    double mean_duration_ns(node_id n) const {
+        auto cnt = node_stats_[n].count_.load();
+        return cnt ? double(node_stats_[n].total_ns_.load()) / double(cnt) : 0.0;
+    }
+
+    //! Recomputes the priorities from the measured average durations, instead of the costs given
+    //! in the template. Must be called while no instance is running.
+    void use_measured_costs() {
+        tmpl_.remaining_path_lengths(
+                order_, [this](node_id n) { return mean_duration_ns(n); }, priorities_.data());
+    }
+
+    //! The makespan statistics of the graphs that finished so far (when measuring)
+    graph_timing_stats timing_stats() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        graph_timing_stats res;
+        res.count_ = timing_.count_;
+        if (timing_.count_ > 0) {
+            res.mean_makespan_us_ = timing_.total_makespan_ns_ / timing_.count_ / 1000.0;
+            res.mean_critical_path_us_ = timing_.total_critical_path_ns_ / timing_.count_ / 1000.0;
+            res.mean_ratio_ = timing_.total_ratio_ / timing_.count_;
+            res.max_ratio_ = timing_.max_ratio_;
+        }
+        return res;
+    }
+    //! The distribution of the makespans (when measuring)
+    const latency_histogram& makespans() const { return makespans_; }
+
+    void reset_timing_stats() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        timing_ = {};
+        makespans_.reset();
+    }
+
+private:
+    friend class graph_instance<Ctx>;
+
+    struct node_stats {
+        std::atomic<uint64_t> total_ns_{0};
+        std::atomic<uint64_t> count_{0};
+    };
+    struct timing_totals {
+        int count_{0};
+        double total_makespan_ns_{0};
+        double total_critical_path_ns_{0};
+        double total_ratio_{0};
+        double max_ratio_{0};
+    };
+    //! A node that is ready to run, in the priority queue (a heap in `ready_`)
+    struct ready_node {
+        uint64_t seq_;
+        double priority_;
+        graph_instance<Ctx>* inst_;
+        node_id node_;
+
+        //! Older instances first; in the same instance, the longest remaining path first
+        bool operator<(const ready_node& other) const {
+            if (seq_ != other.seq_)
+                return seq_ > other.seq_;
+            return priority_ < other.priority_;
+        }
+    };
+
+    const graph_template<Ctx>& tmpl_;
+    const graph_pool_options options_;
+    const std::vector<node_id> order_;
+    std::vector<double> priorities_;
+    std::unique_ptr<node_stats[]> node_stats_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<graph_instance<Ctx>>> all_;
+    std::vector<graph_instance<Ctx>*> free_;
+    timing_totals timing_;
+    latency_histogram makespans_;
+
+    std::atomic<uint64_t> next_seq_{0};
+    std::mutex ready_mutex_;
+    //! Kept as a heap; a vector, so that we can reserve its storage up front
+    std::vector<ready_node> ready_;
+
+    graph_instance<Ctx>* create() {
+        std::unique_ptr<graph_instance<Ctx>> inst{new graph_instance<Ctx>(tmpl_, *this)};
+        auto* res = inst.get();
+        std::lock_guard<std::mutex> lock{mutex_};
+        all_.push_back(std::move(inst));
+        // Make sure that releasing the instance doesn't allocate
+        free_.reserve(all_.size());
+        if (options_.schedule_ == graph_schedule::critical_path) {
+            // Each instance has at most all its nodes ready at once; make sure that pushing ready
+            // nodes doesn't allocate either
+            std::lock_guard<std::mutex> ready_lock{ready_mutex_};
+            ready_.reserve(all_.size() * size_t(tmpl_.num_nodes()));
+        }
+        return res;
+    }
+
+    void release(graph_instance<Ctx>* inst) {
+        if (options_.measure_) {
+            for (int n = 0; n < tmpl_.num_nodes(); n++) {
+                node_stats_[n].total_ns_.fetch_add(
+                        uint64_t(inst->durations_ns_[n]), std::memory_order_relaxed);
+                node_stats_[n].count_.fetch_add(1, std::memory_order_relaxed);
+            }
+            auto [makespan, critical_path] = inst->measure_makespan();
+            makespans_.record(uint64_t(makespan));
+            double ratio = critical_path > 0 ? makespan / critical_path : 1.0;
+            std::lock_guard<std::mutex> lock{mutex_};
+            timing_.count_++;
+            timing_.total_makespan_ns_ += makespan;
+            timing_.total_critical_path_ns_ += critical_path;
+            timing_.total_ratio_ += ratio;
+            timing_.max_ratio_ = std::max(timing_.max_ratio_, ratio);
+            free_.push_back(inst);
+            return;
+        }
+        std::lock_guard<std::mutex> lock{mutex_};
+        free_.push_back(inst);
+    }
+
+    //! Called when a root of an instance is ready to run
+    void schedule(graph_instance<Ctx>* inst, node_id n) {
+        if (options_.schedule_ == graph_schedule::fifo)
+            spawn_fifo(inst, n);
+        else {
+            push_ready(inst, n);
+            spawn_runner();
+        }
+    }
+
+    //! The closure only holds two words, so it fits in the small buffer of `std::function`
+    void spawn_fifo(graph_instance<Ctx>* inst, node_id n) {
+        concore::spawn(concore::task{[inst, n] { inst->run_fifo(n); }});
+    }
+
+    void push_ready(graph_instance<Ctx>* inst, node_id n) {
+        std::lock_guard<std::mutex> lock{ready_mutex_};
+        ready_.push_back(ready_node{inst->seq_, priorities_[n], inst, n});
+        std::push_heap(ready_.begin(), ready_.end());
+    }
+    bool pop_ready(ready_node& res) {
+        std::lock_guard<std::mutex> lock{ready_mutex_};
+        if (ready_.empty())
+            return false;
+        std::pop_heap(ready_.begin(), ready_.end());
+        res = ready_.back();
+        ready_.pop_back();
+        return true;
+    }
+
+    //! Spawns a task that runs the most critical ready node. We spawn one runner for each node that
+    //! we add to the queue, so every node is eventually run; but a runner picks the most critical
+    //! node at the time it starts, not necessarily the one that was added with it.
+    void spawn_runner() {
+        concore::spawn(concore::task{[this] { run_critical(); }});
+    }
+    void run_critical() {
+        ready_node r;
+        while (pop_ready(r)) {
+            int num_ready = 0;
+            r.inst_->execute_node(r.node_, [&](node_id s) {
+                push_ready(r.inst_, s);
+                num_ready++;
+            });
+            // This runner takes care of one of the new nodes; spawn runners for the others
+            if (num_ready == 0)
+                return;
+            for (int i = 1; i < num_ready; i++)
+                spawn_runner();
+        }
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "profiling.hpp"
+
+#include <concore/spawn.hpp>
+#include <concore/data/concurrent_queue.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+//! What a worker does when it runs out of work, before going to sleep
+struct idle_policy {
+    //! How long to busy-spin, checking for new work
+    std::chrono::microseconds spin_{50};
+    //! After spinning, how long to keep checking for work, yielding the CPU between checks
+    std::chrono::microseconds yield_{200};
+    // After this, the worker parks (goes back to concore, which puts it to sleep)
+};
+
+//! Executor that keeps workers awake for a while after they run out of work, trading CPU time
+//! for lower latency on bursty workloads.
+//!
+//! Tasks are placed in a queue, and executed by "poller" tasks that run on the concore workers.
+//! When a poller finds the queue empty, it follows the idle policy: spin, then yield, then park
+//! (the poller ends and the concore worker goes to sleep). A new poller is spawned only if no
+//! poller is idle, so work that arrives while a poller is spinning starts without any wake-up.
+class idle_policy_executor {
+public:
+    explicit idle_policy_executor(idle_policy policy = {}, int max_pollers = 0)
+        : impl_(std::make_shared<impl>()) {
+        impl_->policy_ = policy;
+        impl_->max_pollers_ =
+                max_pollers > 0 ? max_pollers : int(std::thread::hardware_concurrency());
+    }
+
+    void execute(concore::task t) const {
+        impl_->tasks_.push(std::move(t));
+        // If there is an idle poller, it will pick up the task; otherwise, start a new poller
+        if (impl_->idle_pollers_.load() == 0 && impl_->try_add_poller())
+            impl_->spawn_poller();
+    }
+    template <typename F>
+    void execute(F&& f) const {
+        execute(concore::task{std::forward<F>(f)});
+    }
+
+    friend bool operator==(idle_policy_executor l, idle_policy_executor r) {
+        return l.impl_ == r.impl_;
+    }
+    friend bool operator!=(idle_policy_executor l, idle_policy_executor r) { return !(l == r); }
+
+private:
+    struct impl : std::enable_shared_from_this<impl> {
+        idle_policy policy_;
+        int max_pollers_{1};
+        concore::concurrent_queue<concore::task> tasks_;
+        std::atomic<int> num_pollers_{0};
+        std::atomic<int> idle_pollers_{0};
+
+        bool try_add_poller() {
+            int old = num_pollers_.load();
+            while (old < max_pollers_)
+                if (num_pollers_.compare_exchange_weak(old, old + 1))
+                    return true;
+            return false;
+        }
+
+        void spawn_poller() {
+            auto self = shared_from_this();
+            concore::spawn([self] { self->poll(); });
+        }
+
+        //! Waits for a task, according to the idle policy; returns false if we need to park
+        bool wait_for_task(concore::task& t) {
+            using clock = std::chrono::steady_clock;
+            auto start = clock::now();
+            auto spin_end = start + policy_.spin_;
+            auto yield_end = spin_end + policy_.yield_;
+            while (true) {
+                if (tasks_.try_pop(t))
+                    return true;
+                auto now = clock::now();
+                if (now >= yield_end)
+                    return false;
+                if (now >= spin_end)
+                    std::this_thread::yield();
+            }
+        }
+
+        void poll() {
+            CONCORE_PROFILING_SCOPE_N("poller");
+            concore::task t;
+            while (true) {
+                while (tasks_.try_pop(t))
+                    t();
+
+                idle_pollers_++;
+                bool got_task = wait_for_task(t);
+                idle_pollers_--;
+                if (got_task) {
+                    t();
+                    continue;
+                }
+
+                // Park. A task pushed before we stopped being idle may not have started a new
+                // poller; check once more after we leave
+                num_pollers_--;
+                if (!tasks_.try_pop(t))
+                    return;
+                num_pollers_++;
+                t();
+            }
+        }
+    };
+    std::shared_ptr<impl> impl_;
+};
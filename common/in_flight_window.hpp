@@ -0,0 +1,37 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+//! Limits the number of requests in flight, like a server with a bounded number of connections
+class in_flight_window {
+public:
+    explicit in_flight_window(int max)
+        : max_(max) {}
+
+    //! Blocks until a new request can start
+    void acquire() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        cv_.wait(lock, [this] { return count_ < max_; });
+        count_++;
+    }
+    //! Called when a request is done
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            count_--;
+        }
+        cv_.notify_all();
+    }
+    //! Blocks until all the requests are done
+    void wait_all() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        cv_.wait(lock, [this] { return count_ == 0; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int max_;
+    int count_{0};
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "results_table.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! Histogram of latencies, with logarithmic buckets.
+//! Bucket `i` holds the values in [2^(i-1), 2^i) nanoseconds (bucket 0 holds the value 0).
+//! Recording is lock-free, so it can be done from any thread, while the tasks are running.
+class latency_histogram {
+public:
+    static constexpr int num_buckets = 48;
+
+    void record(uint64_t ns) {
+        buckets_[bucket_for(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+        auto old_max = max_ns_.load(std::memory_order_relaxed);
+        while (old_max < ns && !max_ns_.compare_exchange_weak(old_max, ns))
+            ;
+    }
+    template <typename Rep, typename Period>
+    void record(const std::chrono::duration<Rep, Period>& d) {
+        record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+    }
+
+    uint64_t count() const { return count_.load(); }
+    double mean_ns() const { return count_ ? double(sum_ns_.load()) / double(count_.load()) : 0.0; }
+    uint64_t max_ns() const { return max_ns_.load(); }
+
+    //! Approximates the p-th percentile (p in [0, 100]), interpolating inside the bucket
+    double percentile_ns(double p) const {
+        auto total = count_.load();
+        if (total == 0)
+            return 0;
+        double target = p / 100.0 * double(total);
+        double seen = 0;
+        for (int i = 0; i < num_buckets; i++) {
+            double cnt = double(buckets_[i].load());
+            if (cnt > 0 && seen + cnt >= target) {
+                double lo = i == 0 ? 0 : double(uint64_t(1) << (i - 1));
+                double hi = i == 0 ? 1 : double(uint64_t(1) << i);
+                double val = lo + (hi - lo) * (target - seen) / cnt;
+                return std::min(val, double(max_ns_.load()));
+            }
+            seen += cnt;
+        }
+        return double(max_ns_.load());
+    }
+
+    void reset() {
+        for (auto& b : buckets_)
+            b = 0;
+        count_ = 0;
+        sum_ns_ = 0;
+        max_ns_ = 0;
+    }
+
+    //! Adds the summary of this histogram to the current row of the given table.
+    //! The table needs to have the columns returned by `summary_columns`, at this position.
+    void add_summary(results_table& table) const {
+        table.add(double(count()))
+                .add(mean_ns() / 1000.0)
+                .add(percentile_ns(50) / 1000.0)
+                .add(percentile_ns(90) / 1000.0)
+                .add(percentile_ns(99) / 1000.0)
+                .add(double(max_ns()) / 1000.0);
+    }
+    static std::vector<std::string> summary_columns() {
+        return {"count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us"};
+    }
+
+    //! Adds the non-empty buckets to the given table (columns: bucket_lo_us, bucket_hi_us, count)
+    void add_buckets(results_table& table, const std::string& label) const {
+        for (int i = 0; i < num_buckets; i++) {
+            auto cnt = buckets_[i].load();
+            if (cnt == 0)
+                continue;
+            double lo = i == 0 ? 0 : double(uint64_t(1) << (i - 1));
+            double hi = double(uint64_t(1) << i);
+            table.row().add(label).add(lo / 1000.0).add(hi / 1000.0).add(double(cnt));
+        }
+    }
+
+private:
+    std::atomic<uint64_t> buckets_[num_buckets]{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_ns_{0};
+    std::atomic<uint64_t> max_ns_{0};
+
+    static int bucket_for(uint64_t ns) {
+        int b = 0;
+        while (ns > 0 && b < num_buckets - 1) {
+            ns >>= 1;
+            b++;
+        }
+        return b;
+    }
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+//! Kernels that count the letters (a-z, case insensitive) in a text.
+//!
+//! - `count_letters_naive`: `tolower` + `isalpha` for each character, one counter array
+//! - `count_letters_scalar`: byte-to-letter lookup table, and four sub-histograms that are updated
+//!   in turn, so that a run of equal letters doesn't wait on the previous increment (store-to-load
+//!   forwarding); the sub-histograms are merged at the end
+//! - `count_letters_avx2`: compares 32 bytes at a time against each letter, accumulating the
+//!   matches in byte counters that are flushed before they can overflow
+//! - `count_letters`: picks the best kernel supported by the CPU
+//!
+//! All the kernels treat the text as bytes: only ASCII letters are counted (as in the "C" locale).
+//! The counts are added to the given array of `num_letters` counters.
+
+#include "profiling.hpp"
+
+#include <concore/conc_for.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <ctype.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LETTER_HISTOGRAM_AVX2 1
+#include <immintrin.h>
+#endif
+
+constexpr int num_letters = 'z' - 'a' + 1;
+
+inline void count_letters_naive(const char* data, size_t size, uint64_t* counts) {
+    for (size_t i = 0; i < size; i++) {
+        int c = tolower(static_cast<unsigned char>(data[i]));
+        if (c >= 'a' && c <= 'z')
+            counts[c - 'a']++;
+    }
+}
+
+namespace detail {
+//! Maps each byte to its letter index; everything that is not a letter maps to `num_letters`
+inline const uint8_t* letter_index_table() {
+    static const std::array<uint8_t, 256> table = [] {
+        std::array<uint8_t, 256> res{};
+        for (int b = 0; b < 256; b++) {
+            int lower = b | 0x20;
+            res[b] = uint8_t(b < 0x80 && lower >= 'a' && lower <= 'z' ? lower - 'a' : num_letters);
+        }
+        return res;
+    }();
+    return table.data();
+}
+} // namespace detail
+
+inline void count_letters_scalar(const char* data, size_t size, uint64_t* counts) {
+    const uint8_t* table = detail::letter_index_table();
+    const auto* p = reinterpret_cast<const uint8_t*>(data);
+    // Process in blocks small enough for the 32-bit sub-histograms not to overflow
+    constexpr size_t max_block = size_t(1) << 31;
+    while (size > 0) {
+        size_t block = std::min(size, max_block);
+        uint32_t sub[4][num_letters + 1] = {};
+        size_t i = 0;
+        for (; i + 4 <= block; i += 4) {
+            sub[0][table[p[i]]]++;
+            sub[1][table[p[i + 1]]]++;
+            sub[2][table[p[i + 2]]]++;
+            sub[3][table[p[i + 3]]]++;
+        }
+        for (; i < block; i++)
+            sub[0][table[p[i]]]++;
+        for (int l = 0; l < num_letters; l++)
+            counts[l] += uint64_t(sub[0][l]) + sub[1][l] + sub[2][l] + sub[3][l];
+        p += block;
+        size -= block;
+    }
+}
+
+#if LETTER_HISTOGRAM_AVX2
+namespace detail {
+//! Counts the letters [First, First+sizeof...(K)) in `num_vecs` vectors of 32 bytes; at most 255
+//! vectors, so that the byte counters don't overflow. The loop over the letters is unrolled at
+//! compile time (one `K` per letter), so that all the accumulators stay in registers.
+template <int First, size_t... K>
+__attribute__((target("avx2"))) inline void count_letters_block_avx2(
+        const char* data, size_t num_vecs, uint64_t* counts, std::index_sequence<K...>) {
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    __m256i acc[] = {((void)K, _mm256_setzero_si256())...};
+    for (size_t v = 0; v < num_vecs; v++) {
+        // Setting the 0x20 bit turns upper case letters into lower case; the only bytes that end
+        // up in 'a'..'z' are the letters
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + v * 32));
+        x = _mm256_or_si256(x, case_bit);
+        // Matches are -1; subtracting them counts them
+        ((acc[K] = _mm256_sub_epi8(
+                  acc[K], _mm256_cmpeq_epi8(x, _mm256_set1_epi8(char('a' + First + K))))),
+                ...);
+    }
+    for (size_t k = 0; k < sizeof...(K); k++) {
+        __m256i sums = _mm256_sad_epu8(acc[k], _mm256_setzero_si256());
+        counts[First + k] += uint64_t(_mm256_extract_epi64(sums, 0)) +
+                             uint64_t(_mm256_extract_epi64(sums, 1)) +
+                             uint64_t(_mm256_extract_epi64(sums, 2)) +
+                             uint64_t(_mm256_extract_epi64(sums, 3));
+    }
+}
+} // namespace detail
+
+__attribute__((target("avx2"))) inline void count_letters_avx2(
+        const char* data, size_t size, uint64_t* counts) {
+    // Blocks of 255 vectors (~8KB) stay in L1 while we go over them for each group of letters;
+    // a group of 8 letters keeps all the accumulators in registers
+    constexpr size_t block_vecs = 255;
+    size_t num_vecs = size / 32;
+    for (size_t v = 0; v < num_vecs; v += block_vecs) {
+        const char* block = data + v * 32;
+        size_t n = std::min(block_vecs, num_vecs - v);
+        detail::count_letters_block_avx2<0>(block, n, counts, std::make_index_sequence<8>{});
+        detail::count_letters_block_avx2<8>(block, n, counts, std::make_index_sequence<8>{});
+        detail::count_letters_block_avx2<16>(block, n, counts, std::make_index_sequence<8>{});
+        detail::count_letters_block_avx2<24>(block, n, counts, std::make_index_sequence<2>{});
+    }
+    count_letters_scalar(data + num_vecs * 32, size - num_vecs * 32, counts);
+}
+#endif
+
+//! Checks if the AVX2 kernel can be used on this CPU
+inline bool has_avx2_letter_kernel() {
+#if LETTER_HISTOGRAM_AVX2
+    static const bool res = __builtin_cpu_supports("avx2");
+    return res;
+#else
+    return false;
+#endif
+}
+
+//! Counts the letters with the best kernel available
+inline void count_letters(const char* data, size_t size, uint64_t* counts) {
+#if LETTER_HISTOGRAM_AVX2
+    if (has_avx2_letter_kernel()) {
+        count_letters_avx2(data, size, counts);
+        return;
+    }
+#endif
+    count_letters_scalar(data, size, counts);
+}
+
+//! Letter counts for a part of the work, padded so that neighbors don't share cache lines
+struct alignas(64) letter_counts {
+    uint64_t cnt_[num_letters]{};
+};
+
+//! Counts the letters of the parts given by `get_part(i, data, size)`, for i in [0, num_parts), in
+//! parallel. Each task accumulates in place, in its own counters; the counters are added together
+//! at the end, without copying histograms around.
+template <typename GetPart>
+void conc_count_letters(int num_parts, GetPart&& get_part, uint64_t* counts) {
+    CONCORE_PROFILING_FUNCTION();
+    // A few tasks per thread is enough to balance the load
+    int num_tasks = std::min(num_parts, 4 * int(std::max(1u, std::thread::hardware_concurrency())));
+    if (num_tasks <= 0)
+        return;
+    std::vector<letter_counts> partial(num_tasks);
+    concore::conc_for(0, num_tasks, [&](int t) {
+        CONCORE_PROFILING_SCOPE_N("count letters");
+        int first = int(int64_t(num_parts) * t / num_tasks);
+        int last = int(int64_t(num_parts) * (t + 1) / num_tasks);
+        for (int i = first; i < last; i++) {
+            const char* data = nullptr;
+            size_t size = 0;
+            get_part(i, data, size);
+            count_letters(data, size, partial[t].cnt_);
+        }
+    });
+    for (const auto& p : partial)
+        for (int l = 0; l < num_letters; l++)
+            counts[l] += p.cnt_[l];
+}
+
+//! Counts the letters of a contiguous buffer, in parallel
+inline void conc_count_letters(const char* data, size_t size, uint64_t* counts) {
+    constexpr size_t chunk_size = size_t(1) << 16;
+    int num_chunks = int((size + chunk_size - 1) / chunk_size);
+    conc_count_letters(
+            num_chunks,
+            [=](int i, const char*& part, size_t& part_size) {
+                size_t start = size_t(i) * chunk_size;
+                part = data + start;
+                part_size = std::min(chunk_size, size - start);
+            },
+            counts);
+}
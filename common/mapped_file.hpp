@@ -0,0 +1,118 @@
+#pragma once
+
+//! Read-only memory-mapped files, and splitting a text into chunks at word boundaries.
+//!
+//! Mapping a file lets the OS page it in on demand: we don't need to read it into memory first,
+//! and we can process files larger than the memory. Tasks can refer to byte ranges of the mapping
+//! directly, without copying anything.
+
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_SUPPORTED 1
+#endif
+
+//! A file mapped in memory, read-only. Check `valid()` after construction; if the file cannot be
+//! mapped, an error is printed and the object is empty.
+class mapped_file {
+public:
+    mapped_file() = default;
+    explicit mapped_file(const char* path) {
+#if MAPPED_FILE_SUPPORTED
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "mapped_file: cannot open '%s': %s\n", path, strerror(errno));
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            fprintf(stderr, "mapped_file: cannot stat '%s': %s\n", path, strerror(errno));
+            close(fd);
+            return;
+        }
+        size_t size = size_t(st.st_size);
+        if (size > 0) {
+            void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+                fprintf(stderr, "mapped_file: cannot map '%s': %s\n", path, strerror(errno));
+            else {
+                // We read the file front to back; let the OS read ahead aggressively
+                madvise(addr, size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(addr);
+                size_ = size;
+            }
+        }
+        valid_ = size == 0 || data_ != nullptr;
+        // The mapping stays valid after closing the file
+        close(fd);
+#else
+        fprintf(stderr, "mapped_file: memory-mapped files are not supported on this platform\n");
+        (void)path;
+#endif
+    }
+    ~mapped_file() { unmap(); }
+
+    mapped_file(mapped_file&& other) noexcept { swap(other); }
+    mapped_file& operator=(mapped_file&& other) noexcept {
+        mapped_file tmp{std::move(other)};
+        swap(tmp);
+        return *this;
+    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool valid() const { return valid_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::string_view view() const { return {data_, size_}; }
+
+private:
+    const char* data_{nullptr};
+    size_t size_{0};
+    bool valid_{false};
+
+    void swap(mapped_file& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(valid_, other.valid_);
+    }
+
+    void unmap() {
+#if MAPPED_FILE_SUPPORTED
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+};
+
+//! Splits the text into chunks of about `chunk_size` bytes, without cutting words: each chunk
+//! except the last one ends right after a whitespace character. A chunk is extended until the next
+//! whitespace, so a very long word makes its chunk longer. The chunks refer to the given text.
+inline std::vector<std::string_view> split_at_word_boundaries(
+        std::string_view text, size_t chunk_size) {
+    std::vector<std::string_view> res;
+    chunk_size = std::max<size_t>(chunk_size, 1);
+    res.reserve(text.size() / chunk_size + 1);
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = std::min(text.size(), start + chunk_size);
+        while (end < text.size() && !isspace(static_cast<unsigned char>(text[end - 1])))
+            end++;
+        res.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return res;
+}
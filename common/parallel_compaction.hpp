@@ -0,0 +1,165 @@
+#pragma once
+
+//! Parallel stream compaction and segmented scans, over contiguous arrays.
+//!
+//! These use the same blocked structure as the sums in `parallel_scan.hpp`, in two passes:
+//! 1. for each block, in parallel, compute a small summary (number of selected elements, or the
+//!    value of the last segment)
+//! 2. scan the summaries serially, to find where each block starts
+//! 3. for each block, in parallel, produce the output from its starting point
+//!
+//! The input is read twice, and the output is written once; no intermediate arrays (flags,
+//! indices) are materialized. For compaction, the predicate is evaluated twice for each element,
+//! so it should be cheap and without side effects.
+
+#include "profiling.hpp"
+#include "parallel_scan.hpp"
+
+#include <concore/conc_for.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+//! Copies the elements of [first, last) that satisfy `pred` to `d_first`, keeping their order.
+//! Returns the number of copied elements. The output must not overlap the input.
+template <typename T, typename Pred>
+size_t conc_copy_if(const T* first, const T* last, T* d_first, Pred pred,
+        size_t min_block = size_t(1) << 16) {
+    CONCORE_PROFILING_FUNCTION();
+    auto blocks = detail::make_scan_blocks(size_t(last - first), min_block);
+    if (blocks.count_ == 1)
+        return size_t(std::copy_if(first, last, d_first, pred) - d_first);
+
+    // Pass 1: how many elements each block selects
+    std::vector<size_t> offsets(blocks.count_);
+    concore::conc_for(0, int(blocks.count_), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("count");
+        const T* p = first + blocks.begin(b);
+        offsets[b] = size_t(std::count_if(p, p + blocks.size(b), pred));
+    });
+    size_t total = 0;
+    for (auto& o : offsets) {
+        size_t cnt = o;
+        o = total;
+        total += cnt;
+    }
+    // Pass 2: each block copies its elements to its place
+    concore::conc_for(0, int(blocks.count_), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("scatter");
+        const T* p = first + blocks.begin(b);
+        std::copy_if(p, p + blocks.size(b), d_first + offsets[b], pred);
+    });
+    return total;
+}
+
+//! Stable partition into `d_first`: first the elements that satisfy `pred`, then the others, each
+//! group keeping the original order. Returns the number of elements that satisfy `pred`.
+//! The output must not overlap the input.
+template <typename T, typename Pred>
+size_t conc_partition_copy(const T* first, const T* last, T* d_first, Pred pred,
+        size_t min_block = size_t(1) << 16) {
+    CONCORE_PROFILING_FUNCTION();
+    size_t n = size_t(last - first);
+    auto blocks = detail::make_scan_blocks(n, min_block);
+
+    // Pass 1: how many elements of each block satisfy the predicate
+    std::vector<size_t> offsets(blocks.count_);
+    concore::conc_for(0, int(blocks.count_), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("count");
+        const T* p = first + blocks.begin(b);
+        offsets[b] = size_t(std::count_if(p, p + blocks.size(b), pred));
+    });
+    size_t num_true = 0;
+    for (auto& o : offsets) {
+        size_t cnt = o;
+        o = num_true;
+        num_true += cnt;
+    }
+    // Pass 2: before block `b` there are `offsets[b]` selected elements, and the rest of the
+    // elements before the block are not selected
+    concore::conc_for(0, int(blocks.count_), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("scatter");
+        size_t start = blocks.begin(b);
+        T* d_true = d_first + offsets[b];
+        T* d_false = d_first + num_true + (start - offsets[b]);
+        const T* p = first + start;
+        std::partition_copy(p, p + blocks.size(b), d_true, d_false, pred);
+    });
+    return num_true;
+}
+
+namespace detail {
+//! Segmented inclusive scan of one block. `has_carry` tells if `carry` holds the value of the
+//! segment that continues from the previous block. Returns the value of the last segment.
+template <typename T, typename H, typename Op>
+T segmented_scan_block(const T* in, const H* heads, T* out, size_t n, bool has_carry, T carry,
+        const Op& op) {
+    for (size_t i = 0; i < n; i++) {
+        carry = heads[i] || !has_carry ? in[i] : op(carry, in[i]);
+        has_carry = true;
+        out[i] = carry;
+    }
+    return carry;
+}
+
+//! What a block contributes to the following blocks: the value of its last segment, and whether
+//! that segment started inside the block
+template <typename T>
+struct segment_summary {
+    T value_{};
+    bool has_head_{false};
+};
+} // namespace detail
+
+//! Segmented inclusive scan: an inclusive scan with `op` that restarts at each element whose head
+//! flag is set (`heads[i]` converts to true). The first element always starts a segment. For
+//! example, summing [1 2 3 4 5] with heads [1 0 1 0 0] gives [1 3 3 7 12].
+//! `op` must be associative. The output can be the input (in-place scan).
+template <typename T, typename H, typename Op = std::plus<T>>
+void conc_segmented_scan(const T* first, const T* last, const H* heads, T* d_first, Op op = {},
+        size_t min_block = size_t(1) << 16) {
+    CONCORE_PROFILING_FUNCTION();
+    size_t n = size_t(last - first);
+    auto blocks = detail::make_scan_blocks(n, min_block);
+    if (blocks.count_ == 1) {
+        detail::segmented_scan_block(first, heads, d_first, n, false, T{}, op);
+        return;
+    }
+
+    // Pass 1: the value of the last segment of each block, and whether it starts in the block
+    std::vector<detail::segment_summary<T>> summaries(blocks.count_);
+    concore::conc_for(0, int(blocks.count_ - 1), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("block summary");
+        size_t start = blocks.begin(b);
+        size_t end = start + blocks.size(b);
+        // Find the start of the last segment, scanning backwards
+        size_t seg_start = end;
+        while (seg_start > start && !heads[seg_start - 1])
+            seg_start--;
+        auto& s = summaries[b];
+        s.has_head_ = seg_start > start;
+        size_t from = s.has_head_ ? seg_start - 1 : start;
+        if (from < end) {
+            s.value_ = first[from];
+            for (size_t i = from + 1; i < end; i++)
+                s.value_ = op(s.value_, first[i]);
+        }
+    });
+    // The value carried into each block (but the first): the value of the last segment of the
+    // previous block, combined with the carry into the previous block if that segment started
+    // before it
+    std::vector<T> carries(blocks.count_);
+    for (size_t b = 1; b < blocks.count_; b++) {
+        const auto& prev = summaries[b - 1];
+        carries[b] = prev.has_head_ || b == 1 ? prev.value_ : op(carries[b - 1], prev.value_);
+    }
+    // Pass 2: scan each block, starting from its carry
+    concore::conc_for(0, int(blocks.count_), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("block scan");
+        size_t start = blocks.begin(b);
+        detail::segmented_scan_block(first + start, heads + start, d_first + start,
+                blocks.size(b), b > 0, carries[b], op);
+    });
+}
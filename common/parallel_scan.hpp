@@ -0,0 +1,244 @@
+#pragma once
+
+//! Parallel prefix sums over arrays of arithmetic values.
+//!
+//! `concore::conc_scan` works with any associative operation and any iterator; for sums over
+//! contiguous arrays of numbers we can do much better, with a two-pass blocked algorithm:
+//! 1. split the array into a few blocks per thread, and compute the sum of each block in parallel
+//! 2. scan the block sums serially; this gives the starting value of each block
+//! 3. scan each block in parallel, starting from its value
+//!
+//! Each element is read twice and written once, and the total work is the same as for a serial
+//! scan (work-efficient). Within a block, the scan for 32-bit integers and floats uses AVX2, when
+//! the CPU supports it: 8 values are summed in registers with log2(8) shift-and-add steps.
+//!
+//! The output can be the same array as the input (in-place scan). Floating point results can
+//! differ slightly from a serial scan, as the additions are grouped differently.
+
+#include "profiling.hpp"
+
+#include <concore/conc_for.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PARALLEL_SCAN_AVX2 1
+#include <immintrin.h>
+#endif
+
+//! Inclusive scans include the current element in its result; exclusive scans don't
+enum class scan_kind { inclusive, exclusive };
+
+namespace detail {
+
+//! Serial scan of [in, in+n) into `out`, starting from `carry`; returns the sum of everything
+template <scan_kind Kind, typename T>
+T scan_block_scalar(const T* in, T* out, size_t n, T carry) {
+    for (size_t i = 0; i < n; i++) {
+        T x = in[i]; // read before writing; `out` can be `in`
+        if (Kind == scan_kind::exclusive)
+            out[i] = carry;
+        carry += x;
+        if (Kind == scan_kind::inclusive)
+            out[i] = carry;
+    }
+    return carry;
+}
+
+//! Sum of [in, in+n); several accumulators, so that the additions don't form one long chain
+template <typename T>
+T sum_block(const T* in, size_t n) {
+    T acc[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (int k = 0; k < 8; k++)
+            acc[k] += in[i + k];
+    for (; i < n; i++)
+        acc[0] += in[i];
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+#if PARALLEL_SCAN_AVX2
+
+inline bool has_avx2_scan_kernel() {
+    static const bool res = __builtin_cpu_supports("avx2");
+    return res;
+}
+
+//! Inclusive prefix sum of the 8 values of the vector
+__attribute__((target("avx2"))) inline __m256i prefix_in_register(__m256i x) {
+    // Prefix within each 128-bit lane
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    // Add the last value of the low lane to the high lane
+    __m256i t = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    t = _mm256_permute2x128_si256(t, t, 0x08);
+    return _mm256_add_epi32(x, t);
+}
+__attribute__((target("avx2"))) inline __m256 prefix_in_register(__m256 x) {
+    x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+    x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+    __m256 t = _mm256_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+    t = _mm256_permute2f128_ps(t, t, 0x08);
+    return _mm256_add_ps(x, t);
+}
+
+//! Vector operations, so that the kernel can be written once for integers and floats
+struct avx2_int32_ops {
+    using vec = __m256i;
+    template <typename T>
+    __attribute__((target("avx2"))) static vec load(const T* p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+    template <typename T>
+    __attribute__((target("avx2"))) static void store(T* p, vec x) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x);
+    }
+    template <typename T>
+    __attribute__((target("avx2"))) static vec broadcast(T x) {
+        return _mm256_set1_epi32(int32_t(x));
+    }
+    __attribute__((target("avx2"))) static vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    __attribute__((target("avx2"))) static vec prefix(vec x) { return prefix_in_register(x); }
+    __attribute__((target("avx2"))) static vec broadcast_last(vec x) {
+        return _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7));
+    }
+    //! Moves the values one position up; the first one becomes zero
+    __attribute__((target("avx2"))) static vec shift_up(vec x) {
+        x = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6));
+        return _mm256_blend_epi32(x, _mm256_setzero_si256(), 1);
+    }
+};
+struct avx2_float_ops {
+    using vec = __m256;
+    __attribute__((target("avx2"))) static vec load(const float* p) { return _mm256_loadu_ps(p); }
+    __attribute__((target("avx2"))) static void store(float* p, vec x) { _mm256_storeu_ps(p, x); }
+    __attribute__((target("avx2"))) static vec broadcast(float x) { return _mm256_set1_ps(x); }
+    __attribute__((target("avx2"))) static vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+    __attribute__((target("avx2"))) static vec prefix(vec x) { return prefix_in_register(x); }
+    __attribute__((target("avx2"))) static vec broadcast_last(vec x) {
+        return _mm256_permutevar8x32_ps(x, _mm256_set1_epi32(7));
+    }
+    __attribute__((target("avx2"))) static vec shift_up(vec x) {
+        x = _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6));
+        return _mm256_blend_ps(x, _mm256_setzero_ps(), 1);
+    }
+};
+
+template <scan_kind Kind, typename Ops, typename T>
+__attribute__((target("avx2"))) T scan_block_avx2(const T* in, T* out, size_t n, T carry) {
+    using vec = typename Ops::vec;
+    vec carry_v = Ops::broadcast(carry);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        vec p = Ops::prefix(Ops::load(in + i));
+        if (Kind == scan_kind::inclusive)
+            Ops::store(out + i, Ops::add(p, carry_v));
+        else
+            Ops::store(out + i, Ops::add(Ops::shift_up(p), carry_v));
+        carry_v = Ops::add(carry_v, Ops::broadcast_last(p));
+    }
+    T tmp[8];
+    Ops::store(tmp, carry_v);
+    return scan_block_scalar<Kind>(in + i, out + i, n - i, tmp[0]);
+}
+
+#endif
+
+//! Scans one block with the best kernel available for the type
+template <scan_kind Kind, typename T>
+T scan_block(const T* in, T* out, size_t n, T carry) {
+#if PARALLEL_SCAN_AVX2
+    if (has_avx2_scan_kernel()) {
+        if constexpr (std::is_integral_v<T> && sizeof(T) == 4)
+            return scan_block_avx2<Kind, avx2_int32_ops>(in, out, n, carry);
+        else if constexpr (std::is_same_v<T, float>)
+            return scan_block_avx2<Kind, avx2_float_ops>(in, out, n, carry);
+    }
+#endif
+    return scan_block_scalar<Kind>(in, out, n, carry);
+}
+
+//! How the blocked algorithms split an array of `n_` elements into `count_` blocks
+struct scan_blocks {
+    size_t n_;
+    size_t count_;
+
+    size_t begin(size_t b) const { return n_ * b / count_; }
+    size_t size(size_t b) const { return begin(b + 1) - begin(b); }
+};
+
+//! A few blocks per thread, so that the blocks of slower threads can be picked up by others; at
+//! least `min_block` elements per block. The blocked algorithms read the input twice; with a
+//! single core, that's only overhead, so we use a single block.
+inline scan_blocks make_scan_blocks(size_t n, size_t min_block) {
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t max_blocks = num_threads > 1 ? 4 * num_threads : 1;
+    size_t count = std::min(max_blocks, n / std::max<size_t>(min_block, 1));
+    return {n, std::max<size_t>(count, 1)};
+}
+
+} // namespace detail
+
+//! Computes the prefix sums of [first, last) into `d_first`, starting from `init`, in parallel.
+//! The output can be the input (in-place scan), but the ranges must not otherwise overlap.
+//! Blocks have at least `min_block` elements; smaller arrays are scanned serially.
+template <scan_kind Kind, typename T>
+void conc_sum_scan(const T* first, const T* last, T* d_first, T init = T{},
+        size_t min_block = size_t(1) << 16) {
+    static_assert(std::is_arithmetic_v<T>, "conc_sum_scan works with arithmetic types");
+    CONCORE_PROFILING_FUNCTION();
+    size_t n = size_t(last - first);
+    auto blocks = detail::make_scan_blocks(n, min_block);
+    if (blocks.count_ == 1) {
+        detail::scan_block<Kind>(first, d_first, n, init);
+        return;
+    }
+
+    // Pass 1: the sum of each block; we don't need the sum of the last block
+    std::vector<T> offsets(blocks.count_);
+    concore::conc_for(0, int(blocks.count_ - 1), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("block sum");
+        offsets[b] = detail::sum_block(first + blocks.begin(b), blocks.size(b));
+    });
+    // The starting value of each block
+    T carry = init;
+    for (auto& o : offsets) {
+        T sum = o;
+        o = carry;
+        carry += sum;
+    }
+    // Pass 2: scan each block from its starting value
+    concore::conc_for(0, int(blocks.count_), [&](int b) {
+        CONCORE_PROFILING_SCOPE_N("block scan");
+        size_t start = blocks.begin(b);
+        detail::scan_block<Kind>(first + start, d_first + start, blocks.size(b), offsets[b]);
+    });
+}
+
+//! `out[i] = init + in[0] + ... + in[i]`
+template <typename T>
+void conc_inclusive_sum(const T* first, const T* last, T* d_first, T init = T{}) {
+    conc_sum_scan<scan_kind::inclusive>(first, last, d_first, init);
+}
+
+//! `out[i] = init + in[0] + ... + in[i-1]`
+template <typename T>
+void conc_exclusive_sum(const T* first, const T* last, T* d_first, T init = T{}) {
+    conc_sum_scan<scan_kind::exclusive>(first, last, d_first, init);
+}
+
+//! In-place versions of the above
+template <typename T>
+void conc_inclusive_sum_in_place(T* first, T* last, T init = T{}) {
+    conc_sum_scan<scan_kind::inclusive>(first, last, first, init);
+}
+template <typename T>
+void conc_exclusive_sum_in_place(T* first, T* last, T init = T{}) {
+    conc_sum_scan<scan_kind::exclusive>(first, last, first, init);
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+//! Hardware performance counters attached to profiling scopes.
+//!
+//! Each thread opens a group of counters (cycles, instructions, LLC misses, context switches)
+//! using `perf_event_open`. A scope reads the counters when it starts and when it ends, and adds
+//! the difference to the totals of the scope, which are kept per thread. At exit, we print a
+//! report with the totals of all the scopes, including IPC and miss rates.
+//!
+//! Counters are inclusive: a scope also counts the events of the scopes nested in it.
+//! Only supported on Linux; on other platforms the scopes don't count anything.
+
+#include "results_table.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perf_counters {
+
+//! The counters we read
+enum counter_kind {
+    cycles,
+    instructions,
+    llc_misses,
+    context_switches,
+    num_counters,
+};
+
+//! Values for all our counters
+struct counter_values {
+    uint64_t vals_[num_counters]{};
+};
+
+//! The group of counters opened for the current thread
+class thread_counters {
+public:
+    thread_counters() {
+#if defined(__linux__)
+        struct counter_def {
+            uint32_t type_;
+            uint64_t config_;
+        };
+        const counter_def defs[num_counters] = {
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                // Generic cache misses are mapped to LLC misses on most CPUs
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+        };
+        // Open all the counters that we can; the first one opened becomes the group leader
+        for (int i = 0; i < num_counters; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = defs[i].type_;
+            attr.config = defs[i].config_;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = leader_fd_ < 0 ? 1 : 0;
+            // Context switches happen in the kernel; don't exclude it for software events
+            attr.exclude_kernel = defs[i].type_ == PERF_TYPE_HARDWARE ? 1 : 0;
+            attr.exclude_hv = 1;
+            int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader_fd_, 0));
+            if (fd < 0)
+                continue;
+            if (leader_fd_ < 0)
+                leader_fd_ = fd;
+            else
+                member_fds_.push_back(fd);
+            kinds_.push_back(counter_kind(i));
+        }
+        if (leader_fd_ >= 0)
+            ioctl(leader_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    ~thread_counters() {
+#if defined(__linux__)
+        for (int fd : member_fds_)
+            close(fd);
+        if (leader_fd_ >= 0)
+            close(leader_fd_);
+#endif
+    }
+    thread_counters(const thread_counters&) = delete;
+    thread_counters& operator=(const thread_counters&) = delete;
+
+    //! Reads the current values of the counters; the ones we couldn't open stay zero
+    void read_values(counter_values& out) const {
+#if defined(__linux__)
+        if (leader_fd_ < 0)
+            return;
+        uint64_t buf[1 + num_counters];
+        if (read(leader_fd_, buf, sizeof(buf)) < ssize_t(sizeof(uint64_t)))
+            return;
+        auto n = std::min(size_t(buf[0]), kinds_.size());
+        for (size_t i = 0; i < n; i++)
+            out.vals_[kinds_[i]] = buf[1 + i];
+#endif
+    }
+
+    //! Checks if any of the counters could be opened
+    bool is_valid() const { return leader_fd_ >= 0; }
+
+private:
+    int leader_fd_{-1};
+    std::vector<int> member_fds_;
+    //! The kinds of the counters we opened, in the order they appear in the group
+    std::vector<counter_kind> kinds_;
+};
+
+//! The counters of the current thread; opened at first use
+inline const thread_counters& this_thread_counters() {
+    thread_local thread_counters counters;
+    return counters;
+}
+
+//! The accumulated values for a scope
+struct scope_totals {
+    const char* name_{nullptr};
+    uint64_t calls_{0};
+    double wall_ns_{0};
+    counter_values counters_;
+
+    void add(const scope_totals& other) {
+        calls_ += other.calls_;
+        wall_ns_ += other.wall_ns_;
+        for (int i = 0; i < num_counters; i++)
+            counters_.vals_[i] += other.counters_.vals_[i];
+    }
+};
+
+//! The scope totals gathered by one thread.
+//! Owned by the registry, so that it survives the thread; the mutex is only contended when
+//! somebody reads the totals.
+struct thread_scopes {
+    std::mutex mutex_;
+    std::vector<scope_totals> scopes_;
+};
+
+//! Keeps track of the scope totals of all the threads
+class registry {
+public:
+    //! Returns the scope totals of the current thread
+    thread_scopes& this_thread_scopes() {
+        thread_local std::shared_ptr<thread_scopes> ts = [this] {
+            auto res = std::make_shared<thread_scopes>();
+            std::lock_guard<std::mutex> lock{mutex_};
+            threads_.push_back(res);
+            return res;
+        }();
+        return *ts;
+    }
+
+    //! Returns the totals over all the scopes with the given name, across all threads
+    scope_totals get_totals(const char* name) {
+        scope_totals res;
+        res.name_ = name;
+        for (auto& st : all_totals())
+            if (strcmp(st.name_, name) == 0)
+                res.add(st);
+        return res;
+    }
+
+    //! Drops all the totals gathered so far
+    void reset() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (auto& ts : threads_) {
+            std::lock_guard<std::mutex> lock2{ts->mutex_};
+            ts->scopes_.clear();
+        }
+    }
+
+    //! Prints the totals for all the scopes
+    void print_report(FILE* f = stderr) {
+        auto totals = all_totals();
+        if (totals.empty())
+            return;
+        results_table table{{"scope", "calls", "wall_ms", "cycles", "instructions", "ipc",
+                "llc_misses", "llc_mpki", "ctx_switches"}};
+        for (const auto& st : totals) {
+            const auto& v = st.counters_.vals_;
+            double instr = double(v[instructions]);
+            table.row()
+                    .add(st.name_)
+                    .add(double(st.calls_))
+                    .add(st.wall_ns_ / 1e6)
+                    .add(double(v[cycles]))
+                    .add(instr)
+                    .add(v[cycles] ? instr / double(v[cycles]) : 0.0)
+                    .add(double(v[llc_misses]))
+                    .add(instr > 0 ? double(v[llc_misses]) * 1000.0 / instr : 0.0)
+                    .add(double(v[context_switches]));
+        }
+        fprintf(f, "\nPerformance counters per scope (inclusive):\n");
+        if (!this_thread_counters().is_valid())
+            fprintf(f, "(cannot open perf events; check /proc/sys/kernel/perf_event_paranoid)\n");
+        table.print(output_format::text, f);
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<thread_scopes>> threads_;
+
+    //! The totals of all the scopes, merged across threads by scope name
+    std::vector<scope_totals> all_totals() {
+        std::vector<scope_totals> res;
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (auto& ts : threads_) {
+            std::lock_guard<std::mutex> lock2{ts->mutex_};
+            for (const auto& st : ts->scopes_) {
+                auto it = std::find_if(res.begin(), res.end(),
+                        [&](const scope_totals& x) { return strcmp(x.name_, st.name_) == 0; });
+                if (it == res.end())
+                    res.push_back(st);
+                else
+                    it->add(st);
+            }
+        }
+        return res;
+    }
+};
+
+//! Returns the registry of scope totals; at exit, it prints the report.
+//! The registry is never destroyed, as worker threads may still end scopes after `main` returns.
+inline registry& get_registry() {
+    static registry* instance = [] {
+        auto* res = new registry;
+        atexit([] { get_registry().print_report(); });
+        return res;
+    }();
+    return *instance;
+}
+
+//! RAII object that measures the counters for a profiling scope
+class scope {
+public:
+    explicit scope(const char* name)
+        : name_(name) {
+        this_thread_counters().read_values(start_);
+        start_time_ = std::chrono::steady_clock::now();
+    }
+    ~scope() {
+        auto end_time = std::chrono::steady_clock::now();
+        counter_values end;
+        this_thread_counters().read_values(end);
+
+        auto& ts = get_registry().this_thread_scopes();
+        std::lock_guard<std::mutex> lock{ts.mutex_};
+        // Scope names are string literals, so most of the time comparing the pointers is enough
+        auto it = std::find_if(ts.scopes_.begin(), ts.scopes_.end(), [this](const scope_totals& x) {
+            return x.name_ == name_ || strcmp(x.name_, name_) == 0;
+        });
+        if (it == ts.scopes_.end()) {
+            ts.scopes_.emplace_back();
+            it = ts.scopes_.end() - 1;
+            it->name_ = name_;
+        }
+        it->calls_++;
+        it->wall_ns_ += std::chrono::duration<double, std::nano>(end_time - start_time_).count();
+        for (int i = 0; i < num_counters; i++)
+            it->counters_.vals_[i] += end.vals_[i] - start_.vals_[i];
+    }
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+private:
+    const char* name_;
+    counter_values start_;
+    std::chrono::steady_clock::time_point start_time_;
+};
+
+} // namespace perf_counters
+
+#define PERF_COUNTERS_CONCAT_IMPL(a, b) a##b
+#define PERF_COUNTERS_CONCAT(a, b) PERF_COUNTERS_CONCAT_IMPL(a, b)
+
+//! Measures the performance counters from here until the end of the enclosing C++ scope
+#define PERF_COUNTERS_SCOPE(name)                                                                  \
+    perf_counters::scope PERF_COUNTERS_CONCAT(__perf_counters_scope_, __LINE__) { name }
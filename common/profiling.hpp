@@ -0,0 +1,55 @@
+#pragma once
+
+//! Profiling support for the examples.
+//!
+//! By default, the `CONCORE_PROFILING_*` macros are the ones from concore (sending zones to Tracy
+//! when TRACY_ENABLE is set). The examples also have two built-in backends, which can be used
+//! together, without Tracy:
+//!     - TRACER_ENABLE: records a timeline of all the scopes, written as a Chrome/Perfetto trace
+//!       (see tracer.hpp)
+//!     - PERF_COUNTERS_ENABLE: reads hardware performance counters for each scope, and prints a
+//!       per-scope report at exit (see perf_counters.hpp)
+
+#include <concore/profiling.hpp>
+
+#if PERF_COUNTERS_ENABLE || TRACER_ENABLE
+
+#if TRACY_ENABLE
+#error "The built-in profiling backends cannot be combined with TRACY_ENABLE"
+#endif
+
+#if PERF_COUNTERS_ENABLE
+#include "perf_counters.hpp"
+#define PROFILING_PERF_COUNTERS_SCOPE(name) PERF_COUNTERS_SCOPE(name);
+#else
+#define PROFILING_PERF_COUNTERS_SCOPE(name)
+#endif
+
+#if TRACER_ENABLE
+#include "tracer.hpp"
+#define PROFILING_TRACER_SCOPE(name) TRACER_SCOPE(name);
+
+#undef CONCORE_PROFILING_SET_TEXT
+#undef CONCORE_PROFILING_SET_TEXT_FMT
+#undef CONCORE_PROFILING_SET_DYNNAME
+
+#define CONCORE_PROFILING_SET_TEXT(txt) tracer::set_text(txt);
+#define CONCORE_PROFILING_SET_TEXT_FMT(size, ...) tracer::set_text_fmt(__VA_ARGS__);
+#define CONCORE_PROFILING_SET_DYNNAME(name) tracer::set_name(name);
+#else
+#define PROFILING_TRACER_SCOPE(name)
+#endif
+
+#undef CONCORE_PROFILING_SCOPE
+#undef CONCORE_PROFILING_SCOPE_N
+#undef CONCORE_PROFILING_FUNCTION
+
+// The tracer scope is the inner one, so that it doesn't include the cost of reading the counters
+#define CONCORE_PROFILING_SCOPE()                                                                  \
+    PROFILING_PERF_COUNTERS_SCOPE(__func__) PROFILING_TRACER_SCOPE(__func__)
+#define CONCORE_PROFILING_SCOPE_N(name)                                                            \
+    PROFILING_PERF_COUNTERS_SCOPE(name) PROFILING_TRACER_SCOPE(name)
+#define CONCORE_PROFILING_FUNCTION()                                                               \
+    PROFILING_PERF_COUNTERS_SCOPE(__func__) PROFILING_TRACER_SCOPE(__func__)
+
+#endif
@@ -0,0 +1,145 @@
+#pragma once
+
+//! Per-request arena allocation.
+//!
+//! A request typically makes many small allocations (strings, headers, parsed data, the response)
+//! that are all freed together when the request ends. With the global allocator, each of them is a
+//! separate malloc/free, and the workers contend on the allocator. An `arena_resource` is a
+//! `std::pmr::memory_resource` that allocates by bumping a pointer in large blocks and ignores
+//! deallocations; `reset()` frees everything at once. The blocks are kept across resets, so once an
+//! arena has grown to the size of a typical request, it doesn't call the upstream allocator at all.
+//!
+//! Use it with the `std::pmr` containers, and with `make_in_arena` for other objects. Everything
+//! allocated from the arena must be destroyed before `reset()`.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+//! Bump allocator over blocks that are kept across resets. Allocation is protected by a mutex, as
+//! different nodes of the same request can allocate from different threads; the mutex is almost
+//! never contended.
+class arena_resource : public std::pmr::memory_resource {
+public:
+    arena_resource()
+        : arena_resource(4096) {}
+    explicit arena_resource(size_t block_size,
+            std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : block_size_(block_size)
+        , upstream_(upstream) {}
+    ~arena_resource() override {
+        for (auto& b : blocks_)
+            upstream_->deallocate(b.data_, b.size_, alignof(std::max_align_t));
+    }
+    arena_resource(const arena_resource&) = delete;
+    arena_resource& operator=(const arena_resource&) = delete;
+
+    //! Makes all the memory available again; doesn't free the blocks
+    void reset() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        cur_block_ = 0;
+        cur_ = blocks_.empty() ? nullptr : blocks_[0].data_;
+        end_ = blocks_.empty() ? nullptr : blocks_[0].data_ + blocks_[0].size_;
+        used_ = 0;
+    }
+
+    //! The number of bytes allocated since the last reset (including alignment padding)
+    size_t bytes_used() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return used_;
+    }
+    //! The number of bytes obtained from the upstream allocator
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        size_t res = 0;
+        for (const auto& b : blocks_)
+            res += b.size_;
+        return res;
+    }
+
+private:
+    struct block {
+        char* data_;
+        size_t size_;
+    };
+
+    size_t block_size_;
+    std::pmr::memory_resource* upstream_;
+    mutable std::mutex mutex_;
+    std::vector<block> blocks_;
+    size_t cur_block_{0};
+    char* cur_{nullptr};
+    char* end_{nullptr};
+    size_t used_{0};
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        std::lock_guard<std::mutex> lock{mutex_};
+        while (true) {
+            if (cur_) {
+                auto addr = reinterpret_cast<uintptr_t>(cur_);
+                size_t padding = (alignment - addr % alignment) % alignment;
+                if (size_t(end_ - cur_) >= padding + bytes) {
+                    char* res = cur_ + padding;
+                    cur_ = res + bytes;
+                    used_ += padding + bytes;
+                    return res;
+                }
+            }
+            next_block(bytes + alignment);
+        }
+    }
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    //! Moves to the next block with at least `min_size` bytes, allocating it if needed
+    void next_block(size_t min_size) {
+        size_t next = cur_ ? cur_block_ + 1 : 0;
+        // Skip the retained blocks that are too small for this allocation
+        while (next < blocks_.size() && blocks_[next].size_ < min_size)
+            next++;
+        if (next == blocks_.size()) {
+            // Each new block is twice as large as the previous one, so that we need few of them
+            size_t size = blocks_.empty() ? block_size_ : blocks_.back().size_ * 2;
+            size = std::max(size, min_size);
+            auto* data = static_cast<char*>(upstream_->allocate(size, alignof(std::max_align_t)));
+            blocks_.push_back({data, size});
+        }
+        cur_block_ = next;
+        cur_ = blocks_[next].data_;
+        end_ = cur_ + blocks_[next].size_;
+    }
+};
+
+//! Destroys an object created with `make_in_arena`, and gives its memory back to the resource
+template <typename T>
+struct arena_deleter {
+    std::pmr::memory_resource* resource_{nullptr};
+
+    void operator()(T* p) const {
+        p->~T();
+        resource_->deallocate(p, sizeof(T), alignof(T));
+    }
+};
+
+template <typename T>
+using arena_ptr = std::unique_ptr<T, arena_deleter<T>>;
+
+//! Creates an object in the given memory resource (typically an `arena_resource`)
+template <typename T, typename... Args>
+arena_ptr<T> make_in_arena(std::pmr::memory_resource& resource, Args&&... args) {
+    void* mem = resource.allocate(sizeof(T), alignof(T));
+    try {
+        return arena_ptr<T>{new (mem) T(std::forward<Args>(args)...), {&resource}};
+    } catch (...) {
+        resource.deallocate(mem, sizeof(T), alignof(T));
+        throw;
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <utility>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//! The format in which we print benchmark results
+enum class output_format {
+    text, //!< Human-readable, aligned columns
+    csv,  //!< Comma-separated values, with a header line
+    json, //!< Array of objects, one per row
+};
+
+//! Parses the output format from a string ("text", "csv" or "json"); defaults to text
+inline output_format parse_output_format(const std::string& str) {
+    if (str == "csv")
+        return output_format::csv;
+    if (str == "json")
+        return output_format::json;
+    return output_format::text;
+}
+
+//! A table of results; rows are added one by one, and printed at the end in the desired format.
+//! Numeric cells are printed without quotes in JSON; text cells are quoted.
+class results_table {
+public:
+    explicit results_table(std::vector<std::string> columns)
+        : columns_(std::move(columns)) {}
+
+    //! Starts a new row; the cells are filled with the `add` calls that follow
+    results_table& row() {
+        rows_.emplace_back();
+        return *this;
+    }
+    results_table& add(double val) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.6g", val);
+        rows_.back().push_back({buf, true});
+        return *this;
+    }
+    results_table& add(int val) { return add(double(val)); }
+    results_table& add(bool val) {
+        rows_.back().push_back({val ? "true" : "false", true});
+        return *this;
+    }
+    results_table& add(const std::string& val) {
+        rows_.back().push_back({val, false});
+        return *this;
+    }
+    results_table& add(const char* val) { return add(std::string(val)); }
+
+    //! Prints the table to the given file
+    void print(output_format fmt, FILE* f = stdout) const {
+        switch (fmt) {
+        case output_format::text:
+            print_text(f);
+            break;
+        case output_format::csv:
+            print_csv(f);
+            break;
+        case output_format::json:
+            print_json(f);
+            fprintf(f, "\n");
+            break;
+        }
+        fflush(f);
+    }
+
+    //! Prints the rows as a JSON array, indenting each row with the given prefix
+    void print_json(FILE* f, const char* indent = "") const {
+        fprintf(f, "[\n");
+        for (size_t j = 0; j < rows_.size(); j++) {
+            const auto& r = rows_[j];
+            fprintf(f, "%s  {", indent);
+            for (size_t i = 0; i < r.size() && i < columns_.size(); i++) {
+                const char* quote = r[i].numeric_ ? "" : "\"";
+                fprintf(f, "%s\"%s\": %s%s%s", i > 0 ? ", " : "", columns_[i].c_str(), quote,
+                        r[i].val_.c_str(), quote);
+            }
+            fprintf(f, "}%s\n", j + 1 < rows_.size() ? "," : "");
+        }
+        fprintf(f, "%s]", indent);
+    }
+
+private:
+    struct cell {
+        std::string val_;
+        bool numeric_;
+    };
+    std::vector<std::string> columns_;
+    std::vector<std::vector<cell>> rows_;
+
+    void print_text(FILE* f) const {
+        std::vector<size_t> widths;
+        for (const auto& c : columns_)
+            widths.push_back(c.size());
+        for (const auto& r : rows_)
+            for (size_t i = 0; i < r.size() && i < widths.size(); i++)
+                widths[i] = std::max(widths[i], r[i].val_.size());
+
+        for (size_t i = 0; i < columns_.size(); i++)
+            fprintf(f, "%*s  ", int(widths[i]), columns_[i].c_str());
+        fprintf(f, "\n");
+        for (const auto& r : rows_) {
+            for (size_t i = 0; i < r.size() && i < widths.size(); i++)
+                fprintf(f, "%*s  ", int(widths[i]), r[i].val_.c_str());
+            fprintf(f, "\n");
+        }
+    }
+
+    void print_csv(FILE* f) const {
+        for (size_t i = 0; i < columns_.size(); i++)
+            fprintf(f, "%s%s", i > 0 ? "," : "", columns_[i].c_str());
+        fprintf(f, "\n");
+        for (const auto& r : rows_) {
+            for (size_t i = 0; i < r.size(); i++)
+                fprintf(f, "%s%s", i > 0 ? "," : "", r[i].val_.c_str());
+            fprintf(f, "\n");
+        }
+    }
+};
+
+//! Prints multiple named tables, keeping the output a single well-formed document.
+//! In text and CSV format each table is preceded by its name; in JSON we print one object
+//! having the table names as keys.
+inline void print_tables(
+        output_format fmt, std::initializer_list<std::pair<const char*, const results_table*>> tables,
+        FILE* f = stdout) {
+    if (fmt == output_format::json) {
+        fprintf(f, "{\n");
+        size_t i = 0;
+        for (const auto& t : tables) {
+            fprintf(f, "  \"%s\": ", t.first);
+            t.second->print_json(f, "  ");
+            fprintf(f, "%s\n", ++i < tables.size() ? "," : "");
+        }
+        fprintf(f, "}\n");
+        fflush(f);
+        return;
+    }
+    bool first = true;
+    for (const auto& t : tables) {
+        if (!first)
+            fprintf(f, "\n");
+        first = false;
+        fprintf(f, fmt == output_format::csv ? "# %s\n" : "%s:\n", t.first);
+        t.second->print(fmt, f);
+    }
+}
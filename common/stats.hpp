@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+//! Summary statistics over a set of measurements
+struct sample_stats {
+    int count_{0};
+    double min_{0};
+    double max_{0};
+    double mean_{0};
+    double median_{0};
+    double stddev_{0};
+};
+
+//! Returns the p-th percentile (p in [0, 100]) of the given sorted samples.
+//! Uses linear interpolation between the closest ranks.
+inline double percentile_sorted(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    double rank = (p / 100.0) * double(sorted.size() - 1);
+    auto lo = size_t(std::floor(rank));
+    auto hi = size_t(std::ceil(rank));
+    double frac = rank - double(lo);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * frac;
+}
+
+//! Returns the p-th percentile (p in [0, 100]) of the given samples
+inline double percentile(std::vector<double> samples, double p) {
+    std::sort(samples.begin(), samples.end());
+    return percentile_sorted(samples, p);
+}
+
+//! Computes the summary statistics for the given samples
+inline sample_stats compute_stats(std::vector<double> samples) {
+    sample_stats res;
+    if (samples.empty())
+        return res;
+    std::sort(samples.begin(), samples.end());
+    res.count_ = int(samples.size());
+    res.min_ = samples.front();
+    res.max_ = samples.back();
+    res.mean_ = std::accumulate(samples.begin(), samples.end(), 0.0) / double(samples.size());
+    res.median_ = percentile_sorted(samples, 50.0);
+    double sq_sum = 0;
+    for (double s : samples)
+        sq_sum += (s - res.mean_) * (s - res.mean_);
+    // Sample standard deviation; a single sample has no spread
+    res.stddev_ = samples.size() > 1 ? std::sqrt(sq_sum / double(samples.size() - 1)) : 0.0;
+    return res;
+}
+
+//! Runs the given function and returns the elapsed wall-clock time, in milliseconds
+template <typename F>
+inline double time_ms(F&& f) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    f();
+    auto end = clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+//! Built-in, low-overhead timeline tracer.
+//!
+//! Each thread records the scopes it executes in its own ring buffer; only the owning thread
+//! writes to the buffer, so recording needs no locks. The traces of all threads are written as
+//! a Chrome/Perfetto trace (JSON), at exit, or whenever the process receives SIGUSR1.
+//! Load the resulting file in `chrome://tracing` or https://ui.perfetto.dev.
+//!
+//! The output file is `trace.json` unless the CONCORE_TRACE_FILE environment variable says
+//! otherwise. If a thread records more events than its buffer can hold, the oldest events are
+//! dropped; the size of the buffers can be set with CONCORE_TRACE_BUFFER_EVENTS.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace tracer {
+
+//! Returns the current timestamp, in ticks.
+//! On x86 we read the time-stamp counter, which is much cheaper than reading the clock; ticks are
+//! converted to nanoseconds only when writing the trace. Elsewhere, ticks are nanoseconds.
+inline uint64_t now_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+                            .count());
+#endif
+}
+
+//! A completed scope, as recorded in the ring buffers
+struct event {
+    const char* name_{nullptr};
+    uint64_t start_ticks_{0};
+    uint64_t dur_ticks_{0};
+    char text_[32]{0};
+};
+
+static_assert(std::is_trivially_copyable<event>::value, "events are copied word by word");
+
+//! A slot of a ring buffer: an event, stored as atomic words, so that a reader can copy it while
+//! the owning thread overwrites it
+struct event_slot {
+    static constexpr size_t num_words = (sizeof(event) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::atomic<uint64_t> words_[num_words];
+
+    void store(const event& ev) {
+        uint64_t words[num_words]{};
+        std::memcpy(words, &ev, sizeof(event));
+        for (size_t i = 0; i < num_words; i++)
+            words_[i].store(words[i], std::memory_order_relaxed);
+    }
+    event load() const {
+        uint64_t words[num_words];
+        for (size_t i = 0; i < num_words; i++)
+            words[i] = words_[i].load(std::memory_order_relaxed);
+        event res;
+        std::memcpy(&res, words, sizeof(event));
+        return res;
+    }
+};
+
+//! Ring buffer of events for one thread.
+//! The owning thread writes the event, then publishes it by advancing `head_`. Readers can run
+//! concurrently; they discard the events that might have been overwritten while they were reading.
+//! This is a seqlock: `head_` is the sequence number of the slot being written next.
+class thread_buffer {
+public:
+    thread_buffer(int tid, size_t capacity)
+        : tid_(tid)
+        , events_(capacity) {}
+
+    int tid() const { return tid_; }
+
+    void push(const event& ev) {
+        auto h = head_.load(std::memory_order_relaxed);
+        // A reader that sees any of the words we write below also sees `head_ >= h`
+        std::atomic_thread_fence(std::memory_order_release);
+        events_[h % events_.size()].store(ev);
+        head_.store(h + 1, std::memory_order_release);
+    }
+
+    //! Copies the events that are currently in the buffer; returns the number of dropped events
+    uint64_t snapshot(std::vector<event>& out) const {
+        auto cap = uint64_t(events_.size());
+        auto h1 = head_.load(std::memory_order_acquire);
+        auto first = h1 > cap ? h1 - cap : 0;
+        std::vector<event> copy;
+        copy.reserve(size_t(h1 - first));
+        for (auto i = first; i < h1; i++)
+            copy.push_back(events_[i % cap].load());
+        // Events that the writer could have overwritten while we were copying are not reliable.
+        // The fence keeps the reads of the copy before the read of `h2`.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto h2 = head_.load(std::memory_order_relaxed);
+        auto safe_first = h2 > cap ? h2 - cap + 1 : 0;
+        for (auto i = first; i < h1; i++)
+            if (i >= safe_first)
+                out.push_back(copy[size_t(i - first)]);
+        return std::max(first, safe_first);
+    }
+
+private:
+    int tid_;
+    std::vector<event_slot> events_;
+    std::atomic<uint64_t> head_{0};
+};
+
+//! Keeps track of the buffers of all the threads, and writes the trace file
+class registry {
+public:
+    registry()
+        : start_time_(std::chrono::steady_clock::now())
+        , start_ticks_(now_ticks()) {
+        const char* file = getenv("CONCORE_TRACE_FILE");
+        file_name_ = file && *file ? file : "trace.json";
+        const char* cap = getenv("CONCORE_TRACE_BUFFER_EVENTS");
+        if (cap && atoi(cap) > 0)
+            buffer_capacity_ = size_t(atoi(cap));
+    }
+
+    //! Returns the buffer of the current thread; created at first use
+    thread_buffer& this_thread_buffer() {
+        thread_local std::shared_ptr<thread_buffer> buf = [this] {
+            std::lock_guard<std::mutex> lock{mutex_};
+            auto res = std::make_shared<thread_buffer>(int(buffers_.size()), buffer_capacity_);
+            buffers_.push_back(res);
+            return res;
+        }();
+        return *buf;
+    }
+
+    //! Writes all the recorded events to the trace file
+    void dump() {
+        std::lock_guard<std::mutex> dump_lock{dump_mutex_};
+        std::vector<std::shared_ptr<thread_buffer>> buffers;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            buffers = buffers_;
+        }
+
+        FILE* f = fopen(file_name_.c_str(), "w");
+        if (!f) {
+            fprintf(stderr, "tracer: cannot write '%s'\n", file_name_.c_str());
+            return;
+        }
+        // Find out how many ticks we have per nanosecond, from the time elapsed since the start
+        double elapsed_ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start_time_)
+                                    .count();
+        double ticks_per_us = 1000.0 * double(now_ticks() - start_ticks_) / elapsed_ns;
+
+        fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+        fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+                   "\"args\": {\"name\": \"concore\"}}");
+        uint64_t dropped = 0;
+        std::vector<event> events;
+        for (const auto& buf : buffers) {
+            fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                       "\"args\": {\"name\": \"thread %d\"}}",
+                    buf->tid(), buf->tid());
+            events.clear();
+            dropped += buf->snapshot(events);
+            for (const auto& ev : events) {
+                fprintf(f, ",\n{\"name\": \"");
+                write_escaped(f, ev.name_);
+                fprintf(f,
+                        "\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                        buf->tid(), double(ev.start_ticks_ - start_ticks_) / ticks_per_us,
+                        double(ev.dur_ticks_) / ticks_per_us);
+                if (ev.text_[0]) {
+                    fprintf(f, ", \"args\": {\"text\": \"");
+                    write_escaped(f, ev.text_);
+                    fprintf(f, "\"}");
+                }
+                fprintf(f, "}");
+            }
+        }
+        fprintf(f, "\n], \"otherData\": {\"dropped_events\": %llu}}\n",
+                (unsigned long long)dropped);
+        fclose(f);
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_time_;
+    uint64_t start_ticks_;
+    std::string file_name_;
+    size_t buffer_capacity_{1 << 16};
+    std::mutex mutex_;
+    std::mutex dump_mutex_;
+    std::vector<std::shared_ptr<thread_buffer>> buffers_;
+
+    static void write_escaped(FILE* f, const char* str) {
+        for (; str && *str; str++) {
+            char c = *str;
+            if (c == '"' || c == '\\')
+                fprintf(f, "\\%c", c);
+            else if (uint8_t(c) < 0x20)
+                fprintf(f, "\\u%04x", c);
+            else
+                fputc(c, f);
+        }
+    }
+};
+
+//! Returns the tracer registry.
+//! The registry is never destroyed, as worker threads may still record events after `main` ends.
+inline registry& get_registry() {
+    static registry* instance = new registry;
+    return *instance;
+}
+
+//! Sets up the tracer: dump at exit, and dump whenever we receive SIGUSR1.
+//! To handle the signal outside of a signal handler, we block it in this thread (all the threads
+//! created later inherit the mask) and wait for it in a dedicated thread.
+inline bool init() {
+    get_registry();
+    atexit([] { get_registry().dump(); });
+#if defined(__unix__) || defined(__APPLE__)
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    std::thread([set] {
+        while (true) {
+            int sig = 0;
+            if (sigwait(&set, &sig) == 0 && sig == SIGUSR1)
+                get_registry().dump();
+        }
+    }).detach();
+#endif
+    return true;
+}
+
+//! Initialize the tracer before `main` starts, and before any worker thread is created
+inline const bool initialized = init();
+
+//! RAII object that records a scope in the trace
+class scope {
+public:
+    explicit scope(const char* name)
+        : prev_(cur_scope()) {
+        ev_.name_ = name;
+        cur_scope() = this;
+        ev_.start_ticks_ = now_ticks();
+    }
+    ~scope() {
+        ev_.dur_ticks_ = now_ticks() - ev_.start_ticks_;
+        get_registry().this_thread_buffer().push(ev_);
+        cur_scope() = prev_;
+    }
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    //! The innermost scope of the current thread
+    static scope*& cur_scope() {
+        thread_local scope* cur = nullptr;
+        return cur;
+    }
+
+    //! Changes the name of the scope; the name must outlive the trace (e.g., a string literal)
+    void set_name(const char* name) { ev_.name_ = name; }
+
+    //! Attaches a text to the scope; truncated if too long
+    void set_text(const char* text) {
+        strncpy(ev_.text_, text, sizeof(ev_.text_) - 1);
+        ev_.text_[sizeof(ev_.text_) - 1] = 0;
+    }
+    void set_text_fmt(const char* fmt, va_list args) {
+        vsnprintf(ev_.text_, sizeof(ev_.text_), fmt, args);
+    }
+
+private:
+    event ev_;
+    scope* prev_;
+};
+
+//! Sets the text of the innermost scope of the current thread
+inline void set_text(const char* text) {
+    if (auto* s = scope::cur_scope())
+        s->set_text(text);
+}
+inline void set_text_fmt(const char* fmt, ...) {
+    if (auto* s = scope::cur_scope()) {
+        va_list args;
+        va_start(args, fmt);
+        s->set_text_fmt(fmt, args);
+        va_end(args);
+    }
+}
+
+//! Sets the name of the innermost scope of the current thread
+inline void set_name(const char* name) {
+    if (auto* s = scope::cur_scope())
+        s->set_name(name);
+}
+
+} // namespace tracer
+
+#define TRACER_CONCAT_IMPL(a, b) a##b
+#define TRACER_CONCAT(a, b) TRACER_CONCAT_IMPL(a, b)
+
+//! Records a scope, from here until the end of the enclosing C++ scope
+#define TRACER_SCOPE(name)                                                                         \
+    tracer::scope TRACER_CONCAT(__tracer_scope_, __LINE__) { name }
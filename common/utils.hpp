@@ -1,6 +1,6 @@
 #pragma once
 
-#include <concore/profiling.hpp>
+#include "profiling.hpp"
 
 #include <chrono>
 #include <thread>
@@ -1,6 +1,13 @@
 #include <concore/spawn.hpp>
 
 #include "../common/utils.hpp"
+#include "../common/stats.hpp"
+#include "../common/fork_join.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 template <typename F>
 void conc_apply(int start, int end, int granularity, F f) {
@@ -33,6 +40,65 @@ void conc_apply_variant(int start, int end, int granularity, F f) {
     }
 }
 
+//! Same as `conc_apply`, but doesn't allocate memory on every split.
+//! `fork_join` keeps the closures on our stack, and reuses the task groups.
+template <typename F>
+void conc_apply_fork_join(int start, int end, int granularity, const F& f) {
+    if (end - start <= granularity)
+        for (int i = start; i < end; i++)
+            f(i);
+    else {
+        int mid = start + (end - start) / 2;
+        fork_join(
+                // first half
+                [&] { conc_apply_fork_join(start, mid, granularity, f); },
+                // second half
+                [&] { conc_apply_fork_join(mid, end, granularity, f); });
+    }
+}
+
+template <typename F>
+void auto_apply_range(int start, int end, const F& f, concore::task_group grp) {
+    // Set when the last piece that we split off starts executing
+    std::shared_ptr<std::atomic<bool>> split_started;
+    int chunk = 1;
+    while (start < end) {
+        if (!split_started || split_started->load()) {
+            // Somebody took the previous piece; split off half of what's left for the next one
+            if (end - start > 1) {
+                int mid = start + (end - start) / 2;
+                split_started = std::make_shared<std::atomic<bool>>(false);
+                concore::spawn(
+                        [=, started = split_started] {
+                            started->store(true);
+                            auto_apply_range(mid, end, f, grp);
+                        },
+                        grp);
+                end = mid;
+            }
+            chunk = 1;
+        } else {
+            // Nobody is stealing; check less often
+            chunk = std::min(chunk * 2, end - start);
+        }
+        int chunk_end = std::min(end, start + chunk);
+        for (int i = start; i < chunk_end; i++)
+            f(i);
+        start = chunk_end;
+    }
+}
+
+//! Same as `conc_apply`, but doesn't need a granularity.
+//! The range is split lazily: we process it in chunks, and we split off half of the remaining
+//! range only after the previous half we split off was picked up by some worker. If nobody picks
+//! it up, we don't split anymore, and we process larger and larger chunks between checks.
+template <typename F>
+void conc_apply_auto(int start, int end, F f) {
+    auto grp = concore::task_group::create();
+    auto_apply_range(start, end, f, grp);
+    concore::wait(grp);
+}
+
 void work(int idx) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(20, 40);
@@ -51,6 +117,20 @@ int main() {
     conc_apply(0, 20, 1, work);
     printf("---\n");
     conc_apply_variant(0, 20, 1, work);
+    printf("---\n");
+    conc_apply_fork_join(0, 20, 1, work);
+    printf("---\n");
+    conc_apply_auto(0, 20, work);
+    printf("---\n");
+
+    // With tiny loop bodies, a small granularity means a lot of overhead, while a large one
+    // limits the parallelism for heavier bodies. The auto version needs no granularity
+    constexpr int n = 1'000'000;
+    std::vector<double> vals(n);
+    auto tiny_work = [&vals](int i) { vals[i] = double(i) * 0.5; };
+    printf("granularity 10:     %g ms\n", time_ms([&] { conc_apply(0, n, 10, tiny_work); }));
+    printf("granularity 10000:  %g ms\n", time_ms([&] { conc_apply(0, n, 10000, tiny_work); }));
+    printf("auto:               %g ms\n", time_ms([&] { conc_apply_auto(0, n, tiny_work); }));
 
     return 0;
 }
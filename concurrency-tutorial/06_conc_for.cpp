@@ -1,6 +1,10 @@
 #include <concore/conc_for.hpp>
 
 #include "../common/utils.hpp"
+#include "../common/stats.hpp"
+#include "../common/blocked_range.hpp"
+
+#include <vector>
 
 void work(int idx) {
     CONCORE_PROFILING_FUNCTION();
@@ -8,6 +12,23 @@ void work(int idx) {
     printf("I'm a proud worker, working on part %d\n", idx);
 }
 
+//! Transposes a square matrix, splitting the work by rows
+void transpose_rows(const std::vector<float>& in, std::vector<float>& out, int n) {
+    CONCORE_PROFILING_FUNCTION();
+    concore::conc_for(0, n, [&](int i) {
+        for (int j = 0; j < n; j++)
+            out[j * n + i] = in[i * n + j];
+    });
+}
+
+//! Transposes a square matrix, splitting the work in tiles
+void transpose_tiles(const std::vector<float>& in, std::vector<float>& out, int n, int tile_size,
+        tile_order order) {
+    CONCORE_PROFILING_FUNCTION();
+    range2d r{{0, 0}, {n, n}, {tile_size, tile_size}};
+    conc_for_2d(r, [&](int i, int j) { out[j * n + i] = in[i * n + j]; }, order);
+}
+
 int main() {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
@@ -18,5 +39,22 @@ int main() {
 
     // std::for_each(std::execution::par, int_iter{0}, int_iter{20}, work);
 
+    // 2D ranges: a matrix transpose reads rows and writes columns.
+    // Splitting by rows, each task writes to all the cache lines of the output
+    constexpr int n = 4096;
+    std::vector<float> in(size_t(n) * n, 1.0f);
+    std::vector<float> out(size_t(n) * n);
+    printf("transpose, by rows:       %g ms\n", time_ms([&] { transpose_rows(in, out, n); }));
+    printf("transpose, tiles:         %g ms\n",
+            time_ms([&] { transpose_tiles(in, out, n, 64, tile_order::row_major); }));
+    printf("transpose, Morton tiles:  %g ms\n",
+            time_ms([&] { transpose_tiles(in, out, n, 64, tile_order::morton); }));
+    printf("transpose, Hilbert tiles: %g ms\n",
+            time_ms([&] { transpose_tiles(in, out, n, 64, tile_order::hilbert); }));
+
+    // Things to notice:
+    // - tiles keep the working set of a task in the cache
+    // - with the space-filling curves, neighboring tiles are executed by the same worker
+
     return 0;
 }
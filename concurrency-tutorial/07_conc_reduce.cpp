@@ -1,13 +1,13 @@
 #include <concore/conc_reduce.hpp>
 
 #include "../common/utils.hpp"
-
-#include <ctype.h>
+#include "../common/letter_histogram.hpp"
+#include "../common/mapped_file.hpp"
 
 struct simple_histogram {
-    static constexpr int num_letters = 'z' - 'a';
+    static constexpr int num_letters = ::num_letters;
 
-    int cnt_[num_letters];
+    uint64_t cnt_[num_letters];
 
     simple_histogram() {
         for (int i = 0; i < num_letters; i++)
@@ -26,7 +26,7 @@ struct simple_histogram {
     }
 
     void print() const {
-        int sum = std::accumulate(std::begin(cnt_), std::end(cnt_), 0);
+        uint64_t sum = std::accumulate(std::begin(cnt_), std::end(cnt_), uint64_t(0));
         for (int i = 0; i < num_letters; i++) {
             printf("  %c   ", char('a' + i));
         }
@@ -37,13 +37,7 @@ struct simple_histogram {
         printf("\n");
     }
 
-    void add_text_part(std::string_view str) {
-        for (auto c : str) {
-            c = tolower(c);
-            if (isalpha(c))
-                cnt_[c - 'a']++;
-        }
-    }
+    void add_text_part(std::string_view str) { count_letters(str.data(), str.size(), cnt_); }
 
     void join_with(const simple_histogram& other) {
         for (int i = 0; i < num_letters; i++)
@@ -72,10 +66,61 @@ simple_histogram compute_histogram(const text& t) {
     return concore::conc_reduce(t.begin(), t.end(), simple_histogram{}, op, reduction);
 }
 
-int main() {
+//! Computes the same histogram, without passing histograms by value.
+//! Each task counts the letters of a range of words in its own counters, in place; the counters
+//! are added together at the end.
+simple_histogram compute_histogram_in_place(const text& t) {
+    CONCORE_PROFILING_FUNCTION();
+    simple_histogram res;
+    auto get_word = [&t](int i, const char*& data, size_t& size) {
+        data = t[i].data();
+        size = t[i].size();
+    };
+    conc_count_letters(int(t.size()), get_word, res.cnt_);
+    return res;
+}
+
+//! Computes the histogram of a text file, without copying it: the file is mapped in memory and
+//! split into chunks of about 1MB, at word boundaries; `conc_reduce` runs over the chunks, which
+//! refer directly to the mapped memory. With chunks this large, passing the histograms by value
+//! costs nothing compared to counting.
+bool compute_file_histogram(const char* path, simple_histogram& res) {
+    CONCORE_PROFILING_FUNCTION();
+    mapped_file file{path};
+    if (!file.valid())
+        return false;
+    auto chunks = split_at_word_boundaries(file.view(), size_t(1) << 20);
+
+    auto op = [](simple_histogram lhs, std::string_view chunk) {
+        CONCORE_PROFILING_SCOPE_N("op");
+        lhs.add_text_part(chunk);
+        return lhs;
+    };
+    auto reduction = [](simple_histogram lhs, const simple_histogram& rhs) {
+        CONCORE_PROFILING_SCOPE_N("reduction");
+        lhs.join_with(rhs);
+        return lhs;
+    };
+    res = concore::conc_reduce(chunks.begin(), chunks.end(), simple_histogram{}, op, reduction);
+    printf("%s: %zu bytes, %zu chunks\n", path, file.size(), chunks.size());
+    return true;
+}
+
+int main(int argc, char** argv) {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
 
+    // If we are given files, compute their histograms instead of the ones of the built-in texts
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            simple_histogram h;
+            if (!compute_file_histogram(argv[i], h))
+                return 1;
+            h.print();
+        }
+        return 0;
+    }
+
     std::vector<std::string> text1 = {"Happy", "families", "are", "all", "alike;", "every",
             "unhappy", "family", "is", "unhappy", "in", "its", "own", "way.", "Everything", "was",
             "in", "confusion", "in", "the", "Oblonskys’", "house.", "The", "wife", "had",
@@ -147,5 +192,9 @@ int main() {
     h1.print();
     h2.print();
 
+    // Same thing, accumulating in place
+    compute_histogram_in_place(text1).print();
+    compute_histogram_in_place(text2).print();
+
     return 0;
 }
@@ -1,6 +1,8 @@
 #include <concore/conc_scan.hpp>
 
 #include "../common/utils.hpp"
+#include "../common/parallel_scan.hpp"
+#include "../common/parallel_compaction.hpp"
 
 std::vector<int> prefix_sum(const std::vector<int>& vals) {
     CONCORE_PROFILING_FUNCTION();
@@ -18,6 +20,17 @@ std::vector<int> prefix_sum(const std::vector<int>& vals) {
     return res;
 }
 
+//! For plain sums over arrays of numbers, a specialized scan is much faster: the array is split in
+//! blocks, the block sums are computed in parallel, and then the blocks are scanned in parallel,
+//! each starting from the sum of the blocks before it.
+std::vector<int> fast_prefix_sum(const std::vector<int>& vals) {
+    CONCORE_PROFILING_FUNCTION();
+    std::vector<int> res;
+    res.resize(vals.size());
+    conc_inclusive_sum(vals.data(), vals.data() + vals.size(), res.data());
+    return res;
+}
+
 std::vector<int> create_consecutive_seq(int count, int start = 1, int step = 1) {
     std::vector<int> res;
     res.reserve(count);
@@ -43,6 +56,30 @@ int main() {
     print_vec(prefix_sum(create_consecutive_seq(100)));
     printf("---\n");
     print_vec(prefix_sum(create_consecutive_seq(100, 2, 2)));
+    printf("---\n");
+    print_vec(fast_prefix_sum(create_consecutive_seq(100)));
+    printf("---\n");
+    // Exclusive scan, in place: the offsets at which each of the items would start
+    auto offsets = create_consecutive_seq(100, 2, 2);
+    conc_exclusive_sum_in_place(offsets.data(), offsets.data() + offsets.size());
+    print_vec(offsets);
+    printf("---\n");
+
+    // Scans are the building blocks of other parallel algorithms: filtering...
+    auto vals = create_consecutive_seq(100);
+    std::vector<int> odd(vals.size());
+    size_t num_odd = conc_copy_if(
+            vals.data(), vals.data() + vals.size(), odd.data(), [](int x) { return x % 2 != 0; });
+    odd.resize(num_odd);
+    print_vec(odd);
+    printf("---\n");
+    // ... and scans that restart at the beginning of each group (here, groups of 10 values)
+    std::vector<char> heads(vals.size());
+    for (size_t i = 0; i < heads.size(); i += 10)
+        heads[i] = 1;
+    std::vector<int> group_sums(vals.size());
+    conc_segmented_scan(vals.data(), vals.data() + vals.size(), heads.data(), group_sums.data());
+    print_vec(group_sums);
 
     return 0;
 }
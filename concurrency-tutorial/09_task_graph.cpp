@@ -2,78 +2,171 @@
 #include <concore/finish_task.hpp>
 
 #include "../common/utils.hpp"
+#include "../common/graph_template.hpp"
+#include "../common/request_arena.hpp"
 
 #include <memory>
+#include <memory_resource>
+#include <optional>
 #include <vector>
 #include <string>
+#include <thread>
 
 struct data_stream {};
 struct parsed_body {};
 struct request_handling_resources {};
 struct response_data {};
 
+//! All the data of a request is allocated from the memory resource given at construction; with an
+//! `arena_resource`, the request makes no individual heap allocations, and all its memory is
+//! released at once, by resetting the arena.
 struct request_data {
+    explicit request_data(std::pmr::memory_resource* mem)
+        : mem_(mem)
+        , uri_(mem)
+        , headers_(mem)
+        , body_(mem) {}
+
+    // Where the data of the request is allocated
+    std::pmr::memory_resource* mem_;
+
     // Data stream from which we read the request
     data_stream data_stream_;
 
     // Data resulting from reading the request
-    std::string uri_;
-    std::vector<std::pair<std::string, std::string>> headers_;
-    std::string body_;
+    std::pmr::string uri_;
+    std::pmr::vector<std::pair<std::pmr::string, std::pmr::string>> headers_;
+    std::pmr::string body_;
 
     // Parsed body data
-    std::shared_ptr<parsed_body> parsed_body_;
+    arena_ptr<parsed_body> parsed_body_;
 
     // Result of the authentication check
     bool invalid_auth_{false};
 
     // The resources needed for handling the request
-    std::shared_ptr<request_handling_resources> resources_;
+    arena_ptr<request_handling_resources> resources_;
 
     // The response that need to be send back
-    std::shared_ptr<response_data> response_;
+    arena_ptr<response_data> response_;
 };
 
 using request_ptr = std::shared_ptr<request_data>;
 
-void read_http_request(request_ptr req) {
+void read_http_request(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(20, 40);
 }
-void parse_body(request_ptr req) {
+void parse_body(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(30, 50);
+    req.parsed_body_ = make_in_arena<parsed_body>(*req.mem_);
 }
-void authenticate(request_ptr req) {
+void authenticate(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(5, 10);
 }
-void log_start_event(request_ptr req) {
+void log_start_event(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(20, 40);
 }
-void alloc_resources(request_ptr req) {
+void alloc_resources(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(20, 40);
+    req.resources_ = make_in_arena<request_handling_resources>(*req.mem_);
 }
-void compute_result(request_ptr req) {
+void compute_result(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(40, 80);
+    req.response_ = make_in_arena<response_data>(*req.mem_);
 }
-void log_end_event(request_ptr req) {
+void log_end_event(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(20, 40);
 }
-void update_stats(request_ptr req) {
+void update_stats(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(20, 40);
 }
-void send_response(request_ptr req) {
+void send_response(request_data& req) {
     CONCORE_PROFILING_FUNCTION();
     sleep_in_between_ms(20, 40);
 }
 
 
+//! The data of a request handled through a graph template; tells when the request is done.
+//! The arena is reused by all the requests handled by this graph instance.
+struct pooled_request {
+    arena_resource arena_;
+    std::optional<request_data> data_;
+    concore::finish_wait* done_{nullptr};
+
+    //! Releases the data of the previous request, and prepares for a new one
+    void begin_request(concore::finish_wait* done) {
+        data_.reset();
+        arena_.reset();
+        data_.emplace(&arena_);
+        done_ = done;
+    }
+};
+
+//! The same graph as in `main`, defined once; it can be instantiated for any number of requests.
+//! The costs are the average durations of the steps, in ms; they tell which steps are on the
+//! critical path: read -> auth -> alloc -> compute -> ...
+graph_template<pooled_request> make_request_graph() {
+    graph_template<pooled_request> g;
+    using ctx = pooled_request;
+    auto t1 = g.add_node("read", [](ctx& r) { read_http_request(*r.data_); }, 30);
+    auto t2 = g.add_node("parse", [](ctx& r) { parse_body(*r.data_); }, 40);
+    auto t3 = g.add_node("auth", [](ctx& r) { authenticate(*r.data_); }, 7.5);
+    auto t4 = g.add_node("log_start", [](ctx& r) { log_start_event(*r.data_); }, 30);
+    auto t5 = g.add_node("alloc", [](ctx& r) { alloc_resources(*r.data_); }, 30);
+    auto t6 = g.add_node("compute", [](ctx& r) { compute_result(*r.data_); }, 60);
+    auto t7 = g.add_node("log_end", [](ctx& r) { log_end_event(*r.data_); }, 30);
+    auto t8 = g.add_node("stats", [](ctx& r) { update_stats(*r.data_); }, 30);
+    auto t9 = g.add_node("send", [](ctx& r) { send_response(*r.data_); }, 30);
+    auto t_done = g.add_node("done", [](ctx& r) { r.done_->get_continuation()({}); }, 0);
+
+    g.add_edges(t1, {t2, t3});
+    g.add_edge(t2, t4);
+    g.add_edges(t3, {t4, t5});
+    g.add_edge(t4, t7);
+    g.add_edges({t3, t5}, t6);
+    g.add_edges(t6, {t7, t8, t9});
+    g.add_edges({t7, t8, t9}, t_done);
+    return g;
+}
+
+//! Handles several requests with instances of the same graph template. The instances come from a
+//! pool: after the first requests, no nodes or edges are created anymore.
+//! The ready steps on the critical path are executed first; at the end, we compare the time taken
+//! by each request with its critical path.
+void handle_pooled_requests(int num_requests) {
+    CONCORE_PROFILING_FUNCTION();
+    static const auto request_graph = make_request_graph();
+    graph_pool_options options;
+    options.schedule_ = graph_schedule::critical_path;
+    options.measure_ = true;
+    graph_pool<pooled_request> pool{request_graph, 0, options};
+
+    concore::finish_wait done{num_requests};
+    for (int i = 0; i < num_requests; i++) {
+        auto& inst = pool.acquire();
+        inst.context().begin_request(&done);
+        inst.start();
+    }
+    done.wait();
+    // The "done" node signals us before its instance goes back to the pool, and the pool records
+    // the makespan of an instance when it gets it back
+    while (pool.num_free() != pool.size())
+        std::this_thread::yield();
+    printf("%d requests handled with %d graph instances\n", num_requests, pool.size());
+    auto st = pool.timing_stats();
+    printf("makespan: %.1fms on average; critical path: %.1fms; ratio: %.2f (max %.2f)\n",
+            st.mean_makespan_us_ / 1000, st.mean_critical_path_us_ / 1000, st.mean_ratio_,
+            st.max_ratio_);
+}
+
 int main() {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
@@ -82,17 +175,18 @@ int main() {
 
     concore::finish_wait done;
 
-    request_ptr data = std::make_shared<request_data>();
+    arena_resource arena;
+    request_ptr data = std::make_shared<request_data>(&arena);
     // create the tasks
-    concore::chained_task t1{[data] { read_http_request(data); }};
-    concore::chained_task t2{[data] { parse_body(data); }};
-    concore::chained_task t3{[data] { authenticate(data); }};
-    concore::chained_task t4{[data] { log_start_event(data); }};
-    concore::chained_task t5{[data] { alloc_resources(data); }};
-    concore::chained_task t6{[data] { compute_result(data); }};
-    concore::chained_task t7{[data] { log_end_event(data); }};
-    concore::chained_task t8{[data] { update_stats(data); }};
-    concore::chained_task t9{[data] { send_response(data); }};
+    concore::chained_task t1{[data] { read_http_request(*data); }};
+    concore::chained_task t2{[data] { parse_body(*data); }};
+    concore::chained_task t3{[data] { authenticate(*data); }};
+    concore::chained_task t4{[data] { log_start_event(*data); }};
+    concore::chained_task t5{[data] { alloc_resources(*data); }};
+    concore::chained_task t6{[data] { compute_result(*data); }};
+    concore::chained_task t7{[data] { log_end_event(*data); }};
+    concore::chained_task t8{[data] { update_stats(*data); }};
+    concore::chained_task t9{[data] { send_response(*data); }};
     concore::chained_task t_done{concore::task{[]{}, {}, done.get_continuation()}};
 
     // set up dependencies
@@ -109,5 +203,8 @@ int main() {
     // Wait until the graph is done executing
     done.wait();
 
+    // Now, handle a few requests using a graph template
+    handle_pooled_requests(5);
+
     return 0;
 }
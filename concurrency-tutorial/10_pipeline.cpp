@@ -2,6 +2,7 @@
 #include <concore/spawn.hpp>
 
 #include "../common/utils.hpp"
+#include "../common/batched_pipeline.hpp"
 
 #include <memory>
 #include <vector>
@@ -12,6 +13,7 @@ struct frame_data {
     int stage_{0};
     //...
 
+    frame_data() = default;
     explicit frame_data(int idx)
         : frame_idx_(idx) {}
 };
@@ -52,6 +54,18 @@ void postprocess_frame(frame_data& frm) {
     assert(frm.stage_ == 3);
     frm.stage_++;
 }
+//! Post-processes a batch of frames at once; the setup cost is paid once per batch
+void postprocess_frames(item_span<frame_data> frames) {
+    CONCORE_PROFILING_FUNCTION();
+    CONCORE_PROFILING_SET_TEXT_FMT(32, "%d-%d", frames[0].frame_idx_,
+            frames[frames.size() - 1].frame_idx_);
+    sleep_in_between_ms(5, 15);
+    for (auto& frm : frames) {
+        printf("    %d: postprocess (batch of %d)\n", frm.frame_idx_, int(frames.size()));
+        assert(frm.stage_ == 3);
+        frm.stage_++;
+    }
+}
 void write_frame(frame_data& frm) {
     CONCORE_PROFILING_FUNCTION();
     CONCORE_PROFILING_SET_TEXT_FMT(32, "%d", frm.frame_idx_);
@@ -61,8 +75,7 @@ void write_frame(frame_data& frm) {
     frm.stage_++;
 }
 
-int main() {
-    profiling_sleep profiling_helper;
+void test_pipeline() {
     CONCORE_PROFILING_FUNCTION();
 
     auto grp = concore::task_group::create();
@@ -89,6 +102,55 @@ int main() {
 
     // Wait until we've finished everything
     concore::wait(grp);
+}
+
+void test_batched_pipeline() {
+    CONCORE_PROFILING_FUNCTION();
+
+    auto grp = concore::task_group::create();
+
+    static constexpr int max_concurrency = 20;
+
+    // Same pipeline, but post-processing takes the decoded frames in batches of up to 4.
+    // We also measure the stages, to find out which one limits the throughput. Instead of always
+    // keeping `max_concurrency` frames in flight, the pipeline computes how many frames it needs
+    // to keep the workers busy.
+    auto builder = batched_pipeline_builder<frame_data>(max_concurrency, grp);
+    builder.adaptive_concurrency().collect_stats();
+    auto my_pipeline =                                                              //
+            builder                                                                 //
+            | concore::stage_ordering::in_order                                     //
+            | named("parse", parse_frame)                                           //
+            | concore::stage_ordering::concurrent                                   //
+            | named("preprocess", preprocess_frame)                                 //
+            | named("decode", decode_frame)                                         //
+            | concore::stage_ordering::out_of_order                                 //
+            | named("postprocess", in_batches(4, postprocess_frames))               //
+            | concore::stage_ordering::in_order                                     //
+            | named("write", write_frame)                                           //
+            | concore::pipeline_end;
+
+    // Push items through the pipeline; the frames come from the pool of the pipeline, and are
+    // filled in place. The frames that went through the pipeline are reused, not reallocated.
+    for (int i = 0; i < 40; i++) {
+        auto frm = my_pipeline.acquire();
+        frm->frame_idx_ = i;
+        frm->stage_ = 0;
+        my_pipeline.push(std::move(frm));
+    }
+
+    // Wait until we've finished everything
+    concore::wait(grp);
+
+    print_pipeline_report(my_pipeline.stats());
+}
+
+int main() {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    test_pipeline();
+    test_batched_pipeline();
 
     return 0;
 }
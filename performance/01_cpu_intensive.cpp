@@ -2,16 +2,56 @@
 
 #include "../common/utils.hpp"
 #include "../common/cpu_work.hpp"
+#include "../common/bench.hpp"
+#include "../common/stats.hpp"
+
+namespace {
+
+//! Keeps one CPU busy for `work_ms`, then `num_tasks` CPUs busy for the same amount of time
+void run_cpu_intensive(double work_ms, int num_tasks, bench_metrics& metrics) {
+    CONCORE_PROFILING_FUNCTION();
+    auto dur = std::chrono::duration<double, std::milli>(work_ms);
+    auto work = [dur] {
+        CONCORE_PROFILING_SCOPE_N("1 CPU busy");
+        do_work_for(dur);
+    };
+    metrics.add("single_ms", time_ms([&] { concore::spawn_and_wait(work); }));
+    metrics.add("parallel_ms", time_ms([&] {
+        auto grp = concore::task_group::create();
+        for (int i = 0; i < num_tasks; i++)
+            concore::spawn(work, grp);
+        concore::wait(grp);
+    }));
+}
+
+bench_registrar registrar{{
+        "cpu_intensive",
+        "keep one CPU busy, then multiple CPUs busy, for a fixed amount of time",
+        {{{"workers", 0}, {"work_ms", 5000}, {"tasks", 4}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            run_cpu_intensive(p.get("work_ms"), p.get_int("tasks"), m);
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
 
 void work_5s() {
     CONCORE_PROFILING_SCOPE_N("5 seconds, 1 CPU busy");
     do_work_for(5s);
 }
 
+} // namespace
+
 int main() {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
 
+    calibrate_cpu_work();
+
     // Run a simple test to inspect the size of a work unit
     concore::spawn_and_wait([]{
         CONCORE_PROFILING_SCOPE_N("1000 work units");
@@ -33,3 +73,4 @@ int main() {
 
     return 0;
 }
+#endif
@@ -3,36 +3,219 @@
 
 #include "../common/utils.hpp"
 #include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/affinity.hpp"
+#include "../common/latency_histogram.hpp"
+#include "../common/idle_policy_executor.hpp"
+#include "../common/bench.hpp"
 
-int main() {
-    profiling_sleep profiling_helper;
+#include <ctime>
+
+namespace {
+
+//! Spawns `num_tasks` tasks, each keeping a CPU busy for `task_ms`, and waits for them
+void run_tasks(int num_tasks, double task_ms) {
+    CONCORE_PROFILING_SCOPE_N("starting tasks")
+
+    auto grp = concore::task_group::create();
+    auto dur = std::chrono::duration<double, std::milli>(task_ms);
+    auto task_fun = [dur] {
+        CONCORE_PROFILING_SCOPE_N("task");
+        do_work_for(dur);
+    };
+    for (int i = 0; i < num_tasks; i++)
+        concore::spawn(concore::task{task_fun, grp});
+
+    // Wait for all the tasks to finish
+    concore::wait(grp);
+}
+
+//! The latencies we measure with the probe
+struct probe_latencies {
+    //! Latency of the first task after the workers were idle for a while
+    latency_histogram wakeup_;
+    //! Latency of the following tasks in the burst
+    latency_histogram spawn_to_start_;
+};
+
+//! Starts bursts of small tasks, separated by idle gaps, and measures the time from the moment a
+//! task is given to the executor until it starts executing. The first task of each burst has to
+//! wait for a worker to wake up; the others measure the cost of dispatching work.
+//! Returns the CPU time consumed by the process, in milliseconds.
+template <typename E>
+double run_probe(const E& executor, int rounds, int burst, std::chrono::microseconds gap,
+        int64_t task_units, probe_latencies& res) {
     CONCORE_PROFILING_FUNCTION();
+    using clock = std::chrono::steady_clock;
+    std::atomic<int> remaining{0};
+    auto cpu_start = std::clock();
+    for (int r = 0; r < rounds; r++) {
+        // Let the workers go idle
+        std::this_thread::sleep_for(gap);
 
-    // Limit to 4 global working threads
+        remaining = burst;
+        for (int i = 0; i < burst; i++) {
+            auto hist = i == 0 ? &res.wakeup_ : &res.spawn_to_start_;
+            auto t0 = clock::now();
+            executor.execute(concore::task{[t0, hist, task_units, &remaining] {
+                hist->record(clock::now() - t0);
+                CONCORE_PROFILING_SCOPE_N("probe task");
+                do_work_units(task_units);
+                remaining--;
+            }});
+        }
+        // Don't use `concore::wait` here; we don't want this thread to execute the tasks
+        while (remaining.load() > 0)
+            std::this_thread::yield();
+    }
+    return 1000.0 * double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+}
+
+bench_registrar limit_threads_registrar{{
+        "limit_threads",
+        "run CPU-bound tasks on a limited number of workers",
+        {{{"workers", 4}, {"tasks", 100}, {"task_ms", 100}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics&) {
+            run_tasks(p.get_int("tasks"), p.get("task_ms"));
+        },
+}};
+
+//! Runs the probe for the given executor, and reports the percentiles of the latencies
+template <typename E>
+void probe_metrics(const E& executor, const char* prefix, const bench_params& p, bench_metrics& m) {
+    probe_latencies lat;
+    double cpu_ms = run_probe(executor, p.get_int("rounds"), p.get_int("burst"),
+            std::chrono::microseconds(p.get_int("gap_us")), p.get_int("task_units"), lat);
+    auto name = [prefix](const char* suffix) { return std::string(prefix) + suffix; };
+    m.add(name("wakeup_p50_us"), lat.wakeup_.percentile_ns(50) / 1000.0);
+    m.add(name("wakeup_p99_us"), lat.wakeup_.percentile_ns(99) / 1000.0);
+    m.add(name("spawn_to_start_p50_us"), lat.spawn_to_start_.percentile_ns(50) / 1000.0);
+    m.add(name("spawn_to_start_p99_us"), lat.spawn_to_start_.percentile_ns(99) / 1000.0);
+    m.add(name("cpu_ms_per_round"), cpu_ms / p.get_int("rounds"));
+}
+
+bench_registrar wakeup_latency_registrar{{
+        "wakeup_latency",
+        "wake-up and spawn-to-start latencies, with and without the spin-before-park policy",
+        {{{"workers", 4}, {"rounds", 200}, {"burst", 4}, {"gap_us", 2000}, {"task_units", 1},
+                {"spin_us", 50}, {"yield_us", 200}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            idle_policy policy;
+            policy.spin_ = std::chrono::microseconds(p.get_int("spin_us"));
+            policy.yield_ = std::chrono::microseconds(p.get_int("yield_us"));
+            probe_metrics(concore::spawn_executor{}, "spawn_", p, m);
+            probe_metrics(idle_policy_executor{policy, p.get_int("workers")}, "idle_policy_", p, m);
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Measures the wake-up and spawn-to-start latencies, with concore's default idle behavior and
+//! with a spin-then-yield-then-park idle policy, for different gaps between the bursts
+void latency_probe(const cmd_line& args, const placement_config& placement) {
+    CONCORE_PROFILING_FUNCTION();
+
+    int num_workers = args.get_int("workers", 4);
     concore::init_data config;
-    config.num_workers_ = 4;
+    config.num_workers_ = num_workers;
+    apply_placement(config, placement);
     concore::init(config);
 
-    auto grp = concore::task_group::create();
+    int rounds = std::max(1, args.get_int("rounds", 200));
+    int burst = std::max(1, args.get_int("burst", num_workers));
+    auto gaps = args.get_int_list("gap-us");
+    if (gaps.empty())
+        gaps = {20, 200, 2000, 20000};
+    idle_policy policy;
+    policy.spin_ = std::chrono::microseconds(args.get_int("spin-us", 50));
+    policy.yield_ = std::chrono::microseconds(args.get_int("yield-us", 200));
+    int64_t task_units = args.get_int("task-units", 1);
+    auto fmt = parse_output_format(args.get("format", "text"));
 
-    {
-        CONCORE_PROFILING_SCOPE_N("starting tasks")
+    auto columns = std::vector<std::string>{"executor", "gap_us", "latency"};
+    for (const auto& c : latency_histogram::summary_columns())
+        columns.push_back(c);
+    columns.push_back("cpu_ms_per_round");
+    results_table summary{columns};
+    results_table buckets{{"series", "bucket_lo_us", "bucket_hi_us", "count"}};
 
-        // Create 100 tasks
-        auto task_fun = [] {
-            CONCORE_PROFILING_SCOPE_N("task");
-            do_work_for(100ms);
-        };
-        for (int i = 0; i < 100; i++)
-            concore::spawn(concore::task{task_fun, grp});
+    auto report = [&](const char* name, int gap_us, const probe_latencies& lat, double cpu_ms) {
+        summary.row().add(name).add(gap_us).add("wakeup");
+        lat.wakeup_.add_summary(summary);
+        summary.add(cpu_ms / rounds);
+        summary.row().add(name).add(gap_us).add("spawn_to_start");
+        lat.spawn_to_start_.add_summary(summary);
+        summary.add(cpu_ms / rounds);
+        auto prefix = std::string(name) + "/" + std::to_string(gap_us) + "us/";
+        lat.wakeup_.add_buckets(buckets, prefix + "wakeup");
+        lat.spawn_to_start_.add_buckets(buckets, prefix + "spawn_to_start");
+    };
 
-        // Wait for all the tasks to finish
-        concore::wait(grp);
+    idle_policy_executor spinning{policy, num_workers};
+    for (int gap_us : gaps) {
+        auto gap = std::chrono::microseconds(gap_us);
+        {
+            probe_latencies lat;
+            double cpu_ms =
+                    run_probe(concore::spawn_executor{}, rounds, burst, gap, task_units, lat);
+            report("spawn", gap_us, lat, cpu_ms);
+        }
+        {
+            probe_latencies lat;
+            double cpu_ms = run_probe(spinning, rounds, burst, gap, task_units, lat);
+            report("idle_policy", gap_us, lat, cpu_ms);
+        }
     }
 
+    if (fmt == output_format::text)
+        printf("Latency probe: %d workers, bursts of %d tasks, %d rounds; "
+               "idle policy: spin %dus, yield %dus, then park\n",
+                num_workers, burst, rounds, int(policy.spin_.count()),
+                int(policy.yield_.count()));
+    if (args.has("buckets"))
+        print_tables(fmt, {{"summary", &summary}, {"buckets", &buckets}});
+    else
+        summary.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    // Optionally, pin the workers to cores (`--placement compact|scatter`)
+    cmd_line args{argc, argv};
+    placement_config placement;
+    placement.placement_ = parse_worker_placement(args.get("placement", "none"));
+
+    // `--probe` measures the gap between tasks (wake-up and spawn-to-start latencies)
+    if (args.has("probe")) {
+        latency_probe(args, placement);
+        return 0;
+    }
+
+    // Limit to 4 global working threads
+    concore::init_data config;
+    config.num_workers_ = 4;
+    apply_placement(config, placement);
+    concore::init(config);
+
+    // Create 100 tasks of 100ms each
+    run_tasks(100, 100);
+
     // Things to notice:
     // - number of threads that execute work: 4+1
     // - gap between tasks
+    //   (use `--probe` to measure it, and to compare it with a spin-before-park idle policy)
 
     return 0;
 }
+#endif
@@ -3,13 +3,22 @@
 
 #include "../common/utils.hpp"
 #include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+
+#include <thread>
+#include <vector>
+
+namespace {
 
 void work() {
     CONCORE_PROFILING_FUNCTION();
     cpu_busy_work_large_unit();
 }
 
-static constexpr int num_tasks = 50;
+int num_tasks = 50;
 
 void run_tasks_serially() {
     CONCORE_PROFILING_FUNCTION();
@@ -25,10 +34,248 @@ void run_tasks_with_spawn() {
     concore::wait(grp);
 }
 
-int main() {
+//! Runs the tasks with spawn, making sure that this thread doesn't get any work
+void run_tasks_on_workers() {
+    CONCORE_PROFILING_FUNCTION();
+    std::atomic<bool> done{false};
+    concore::spawn([&] {
+        run_tasks_with_spawn();
+        done = true;
+    });
+
+    // Just sleep until the other thread is done
+    while (!done.load())
+        sleep_for(1ms);
+}
+
+//! The ways in which we execute the tasks in the spawn-overhead sweep
+enum class spawn_variant {
+    group_wake,    //!< spawn in a task_group, wake workers, wait on the group
+    group_nowake,  //!< spawn in a task_group, don't wake workers, wait on the group
+    nogroup_wake,  //!< spawn without a group, wake workers, last task signals completion
+    nogroup_nowake //!< spawn without a group, don't wake workers, last task signals completion
+};
+
+bench_registrar registrar{{
+        "spawn_overhead",
+        "run the same tasks serially and with spawn",
+        {{{"workers", 1}, {"tasks", 50}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            num_tasks = p.get_int("tasks");
+            double serial_ms = time_ms(run_tasks_serially);
+            double spawn_ms = time_ms(run_tasks_on_workers);
+            m.add("serial_ms", serial_ms);
+            m.add("spawn_ms", spawn_ms);
+            m.add("overhead_ns_per_task", (spawn_ms - serial_ms) * 1e6 / num_tasks);
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+const char* to_string(spawn_variant v) {
+    switch (v) {
+    case spawn_variant::group_wake:
+        return "group_wake";
+    case spawn_variant::group_nowake:
+        return "group_nowake";
+    case spawn_variant::nogroup_wake:
+        return "nogroup_wake";
+    case spawn_variant::nogroup_nowake:
+        return "nogroup_nowake";
+    }
+    return "";
+}
+
+//! Times the execution of `num` tasks of `iterations` each, executed serially
+double time_serial(int num, int64_t iterations) {
+    CONCORE_PROFILING_FUNCTION();
+    return time_ms([=] {
+        for (int i = 0; i < num; i++)
+            cpu_busy_spin(iterations);
+    });
+}
+
+//! Times the execution of `num` tasks of `iterations` each, spawned with the given variant.
+//! Everything happens on the worker threads; this thread just polls for completion, so that it
+//! doesn't take any tasks.
+double time_spawn(spawn_variant variant, int num, int64_t iterations) {
+    CONCORE_PROFILING_FUNCTION();
+    using clock = std::chrono::steady_clock;
+
+    bool wake_workers =
+            variant == spawn_variant::group_wake || variant == spawn_variant::nogroup_wake;
+    bool use_group = variant == spawn_variant::group_wake || variant == spawn_variant::group_nowake;
+
+    clock::time_point start, end;
+    std::atomic<int> remaining{num};
+    std::atomic<bool> done{false};
+
+    // We return as soon as `done` is set, maybe before the spawning task leaves its loop. The tasks
+    // capture by value everything they only read, and don't touch our frame after setting `done`.
+    concore::spawn([&start, &end, &remaining, &done, use_group, wake_workers, num, iterations] {
+        start = clock::now();
+        if (use_group) {
+            auto grp = concore::task_group::create();
+            for (int i = 0; i < num; i++)
+                concore::spawn(concore::task{[iterations] { cpu_busy_spin(iterations); }, grp},
+                        wake_workers);
+            concore::wait(grp);
+            end = clock::now();
+            done = true;
+        } else {
+            // Without a group, the last task to complete records the end time
+            auto task_fun = [&end, &remaining, &done, iterations] {
+                cpu_busy_spin(iterations);
+                if (--remaining == 0) {
+                    end = clock::now();
+                    done = true;
+                }
+            };
+            for (int i = 0; i < num; i++)
+                concore::spawn(concore::task{task_fun}, wake_workers);
+        }
+    });
+
+    while (!done.load())
+        sleep_for(1ms);
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+//! The task sizes used in the sweep, in nanoseconds: 1-2-5 steps from `min_ns` to `max_ns`
+std::vector<double> sweep_task_sizes(double min_ns, double max_ns) {
+    std::vector<double> res;
+    for (double decade = 1; decade <= max_ns; decade *= 10)
+        for (double m : {1.0, 2.0, 5.0})
+            if (decade * m >= min_ns && decade * m <= max_ns)
+                res.push_back(decade * m);
+    return res;
+}
+
+//! Characterizes the overhead of spawning tasks, for task sizes from ~50ns to 10ms.
+//! Tasks are built from `cpu_busy_spin` iterations, so we can go below the cost of a work unit.
+//!
+//! For each task size and each spawn variant, we measure the per-task overhead compared to
+//! executing the same work serially, and the ratio between this overhead and the task size. The
+//! overhead is the worker time not spent on useful work: the spawn time multiplied by the number
+//! of workers, minus the serial time; workers left idle count as overhead, too.
+//! At the end, for each variant, we report the task granularity below which the spawn overhead
+//! exceeds 5%, 10% and 50% of the useful work.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency); with a
+//!                         single worker, there is no other worker to wake, and the wake and
+//!                         no-wake variants measure the same thing
+//!     --min-ns X          smallest task size, in ns (default: 50)
+//!     --max-ns X          largest task size, in ns (default: 10ms)
+//!     --budget-ms X       approximate amount of work per measurement (default: 200)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void overhead_sweep(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    int num_workers = args.get_int("workers", 0);
+    if (num_workers <= 0)
+        num_workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    concore::init_data config;
+    config.num_workers_ = num_workers;
+    concore::init(config);
+
+    double min_ns = args.get_double("min-ns", 50);
+    double max_ns = args.get_double("max-ns", 10e6);
+    double budget_ns = args.get_double("budget-ms", 200) * 1e6;
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    double ns_per_iter = calibrate_cpu_work().ns_per_iteration_;
+
+    const spawn_variant variants[] = {spawn_variant::group_wake, spawn_variant::group_nowake,
+            spawn_variant::nogroup_wake, spawn_variant::nogroup_nowake};
+    constexpr int num_variants = sizeof(variants) / sizeof(variants[0]);
+    const double thresholds[] = {0.05, 0.10, 0.50};
+
+    // For each variant, the smallest task size from which the overhead stays below each threshold
+    // (-1 if even the largest tasks are above the threshold)
+    double granularity[num_variants][3];
+    bool crossed[num_variants][3];
+    for (int v = 0; v < num_variants; v++)
+        for (int t = 0; t < 3; t++) {
+            granularity[v][t] = -1;
+            crossed[v][t] = false;
+        }
+
+    results_table table{{"variant", "task_ns", "num_tasks", "serial_ms", "spawn_ms",
+            "overhead_ns_per_task", "overhead_ratio"}};
+    std::vector<double> sizes = sweep_task_sizes(min_ns, max_ns);
+    // Go from the largest tasks to the smallest, so that we know where the thresholds are crossed
+    for (auto it = sizes.rbegin(); it != sizes.rend(); ++it) {
+        auto iterations = std::max(int64_t(1), int64_t(*it / ns_per_iter));
+        double task_ns = double(iterations) * ns_per_iter;
+        int num = int(std::min(200'000.0, std::max(20.0, budget_ns / task_ns)));
+
+        std::vector<double> serial_samples;
+        for (int r = 0; r < reps; r++)
+            serial_samples.push_back(time_serial(num, iterations));
+        double serial_ms = compute_stats(serial_samples).median_;
+
+        for (int v = 0; v < num_variants; v++) {
+            std::vector<double> samples;
+            for (int r = 0; r < reps; r++)
+                samples.push_back(time_spawn(variants[v], num, iterations));
+            double spawn_ms = compute_stats(samples).median_;
+            double worker_ms = spawn_ms * num_workers;
+            double overhead_ns = std::max(0.0, (worker_ms - serial_ms) * 1e6 / double(num));
+            double ratio = overhead_ns / task_ns;
+
+            table.row()
+                    .add(to_string(variants[v]))
+                    .add(task_ns)
+                    .add(num)
+                    .add(serial_ms)
+                    .add(spawn_ms)
+                    .add(overhead_ns)
+                    .add(ratio);
+
+            // Record the sizes for which we are still under the thresholds
+            for (int t = 0; t < 3; t++) {
+                if (crossed[v][t])
+                    continue;
+                if (ratio <= thresholds[t])
+                    granularity[v][t] = task_ns;
+                else
+                    crossed[v][t] = true;
+            }
+        }
+    }
+
+    results_table summary{{"variant", "granularity_ns_5pct", "granularity_ns_10pct",
+            "granularity_ns_50pct"}};
+    for (int v = 0; v < num_variants; v++) {
+        summary.row().add(to_string(variants[v]));
+        for (int t = 0; t < 3; t++)
+            summary.add(granularity[v][t]);
+    }
+    print_tables(fmt, {{"measurements", &table}, {"granularity", &summary}});
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
 
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    if (args.has("sweep")) {
+        overhead_sweep(args);
+        return 0;
+    }
+
     // Limit to 1 global working thread
     concore::init_data config;
     config.num_workers_ = 1;
@@ -39,15 +286,7 @@ int main() {
 
     // Now, run the test that spawns the task.
     // Make sure this thread doesn't get any work
-    std::atomic<bool> done{false};
-    concore::spawn([&] {
-        run_tasks_with_spawn();
-        done = true;
-    });
-
-    // Just sleep until the other thread is done
-    while (!done.load())
-        sleep_for(500ms);
+    run_tasks_on_workers();
 
     // Things to notice:
     // - the two methods execute in roughly the same amount of time
@@ -55,3 +294,4 @@ int main() {
 
     return 0;
 }
+#endif
@@ -3,27 +3,25 @@
 
 #include "../common/utils.hpp"
 #include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/affinity.hpp"
+#include "../common/bench.hpp"
+
+#include <vector>
+
+namespace {
 
 void work() {
     CONCORE_PROFILING_FUNCTION();
     cpu_busy_work_large_unit();
 }
 
-static constexpr int num_tasks = 96;
-
-void run_tasks_serially() {
-    CONCORE_PROFILING_FUNCTION();
-    for (int i = 0; i < num_tasks; i++)
-        work();
-}
+int num_tasks = 96;
 
-void set_num_workers(int count) {
-    CONCORE_PROFILING_FUNCTION();
-    concore::shutdown();
-    concore::init_data config;
-    config.num_workers_ = count;
-    concore::init(config);
-}
+//! How we place the workers when we (re)initialize concore
+placement_config workers_placement;
 
 double time_run_tasks() {
     CONCORE_PROFILING_FUNCTION();
@@ -41,9 +39,8 @@ double time_run_tasks() {
     return elapsed.count();
 }
 
-double run_test(int num_workers) {
-    set_num_workers(num_workers);
-
+//! Times the tasks on the worker threads; this thread doesn't execute any of them
+double time_on_workers() {
     CONCORE_PROFILING_FUNCTION();
 
     double dur_ms;
@@ -56,21 +53,205 @@ double run_test(int num_workers) {
 
     // Just sleep until the other thread is done
     while (!done.load())
-        sleep_for(500ms);
+        sleep_for(1ms);
 
     return dur_ms;
 }
 
+//! The results of measuring one worker count in the scaling sweep
+struct scaling_point {
+    int num_workers_{0};
+    worker_placement placement_{worker_placement::none};
+    sample_stats stats_;
+    double speedup_{0};
+    double efficiency_{0};
+    bool oversubscribed_{false};
+    bool knee_{false};
+#if PERF_COUNTERS_ENABLE
+    //! Performance counters for the `work` scope, to make indirect contention visible
+    perf_counters::scope_totals work_counters_;
+#endif
+};
+
+bench_registrar registrar{{
+        "num_worker_threads",
+        "run the same CPU-bound tasks with a given number of workers",
+        {{{"workers", 4}, {"tasks", 96}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            num_tasks = p.get_int("tasks");
+            m.add("tasks_ms", time_on_workers());
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+double run_test(int num_workers) {
+    set_num_workers(num_workers, workers_placement);
+    return time_on_workers();
+}
+
 void report_n_threads(int count, double t1) {
     double t_n = run_test(count);
     printf("Time %d threads: %g; speedup=%.2f\n", count, t_n, t1/t_n);
     fflush(stdout);
 }
 
-int main() {
+//! Returns the worker counts to be used in the scaling sweep.
+//! We go from 1 to `max_workers` with the given step (always including 1, 2 and `max_workers`),
+//! followed by a few oversubscription points (1.5x and 2x `max_workers`).
+std::vector<int> sweep_worker_counts(int max_workers, int step) {
+    std::vector<int> res{1};
+    if (max_workers >= 2)
+        res.push_back(2);
+    for (int n = step; n < max_workers; n += step)
+        if (n > res.back())
+            res.push_back(n);
+    if (max_workers > res.back())
+        res.push_back(max_workers);
+    for (int n : {max_workers + max_workers / 2, 2 * max_workers})
+        if (n > res.back())
+            res.push_back(n);
+    return res;
+}
+
+//! Marks the knee of the speedup curve: the last point after which adding one more worker
+//! brings less than `min_gain` of additional speedup.
+void mark_knee(std::vector<scaling_point>& points, double min_gain) {
+    for (size_t i = 0; i + 1 < points.size(); i++) {
+        const auto& cur = points[i];
+        const auto& next = points[i + 1];
+        if (next.num_workers_ <= cur.num_workers_)
+            continue;
+        double gain = (next.speedup_ - cur.speedup_) / double(next.num_workers_ - cur.num_workers_);
+        if (gain < min_gain) {
+            points[i].knee_ = true;
+            return;
+        }
+    }
+}
+
+//! Sweeps the number of workers, repeating each measurement multiple times.
+//! Reports the median time, the standard deviation, the speedup and the parallel efficiency
+//! for each worker count, and marks the point where the speedup flattens.
+//!
+//! Options:
+//!     --max-workers N     the maximum number of workers (default: hardware concurrency)
+//!     --step N            the step between worker counts (default: max-workers/16, at least 1)
+//!     --reps N            how many times to repeat each measurement (default: 5)
+//!     --tasks N           number of tasks to run in each measurement (default: 96)
+//!     --knee-gain X       min speedup gain per extra worker before we call it a knee
+//!                         (default 0.25)
+//!     --placement P       worker placement: none, compact, scatter, or compare to run the sweep
+//!                         for all of them (default: none)
+//!     --no-smt            when pinning, use only one hardware thread per core
+//!     --format F          text, csv or json (default: text)
+//!
+//! When built with PERF_COUNTERS=YES, we also report the IPC, the LLC misses per 1000 instructions
+//! and the context switches for the work tasks; indirect contention shows up as falling IPC and
+//! rising miss rates as the number of workers grows.
+void scaling_sweep(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    int hw_threads = int(std::thread::hardware_concurrency());
+    int max_workers = std::max(1, args.get_int("max-workers", hw_threads));
+    int step = std::max(1, args.get_int("step", max_workers / 16));
+    int reps = std::max(1, args.get_int("reps", 5));
+    double knee_gain = args.get_double("knee-gain", 0.25);
+    num_tasks = args.get_int("tasks", num_tasks);
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    std::vector<worker_placement> placements;
+    std::string placement_arg = args.get("placement", "none");
+    if (placement_arg == "compare")
+        placements = {worker_placement::none, worker_placement::compact, worker_placement::scatter};
+    else
+        placements = {parse_worker_placement(placement_arg)};
+    workers_placement.use_smt_ = !args.has("no-smt");
+
+    std::vector<scaling_point> points;
+    for (auto placement : placements) {
+        workers_placement.placement_ = placement;
+        std::vector<scaling_point> cur_points;
+        for (int count : sweep_worker_counts(max_workers, step)) {
+#if PERF_COUNTERS_ENABLE
+            perf_counters::get_registry().reset();
+#endif
+            std::vector<double> samples;
+            samples.reserve(reps);
+            for (int i = 0; i < reps; i++)
+                samples.push_back(run_test(count));
+
+            scaling_point pt;
+#if PERF_COUNTERS_ENABLE
+            pt.work_counters_ = perf_counters::get_registry().get_totals("work");
+#endif
+            pt.num_workers_ = count;
+            pt.placement_ = placement;
+            pt.stats_ = compute_stats(std::move(samples));
+            pt.oversubscribed_ = count > hw_threads;
+            cur_points.push_back(pt);
+        }
+
+        // Speedup and efficiency are computed against the median of the 1-worker runs
+        double t1 = cur_points.front().stats_.median_;
+        for (auto& pt : cur_points) {
+            pt.speedup_ = t1 / pt.stats_.median_;
+            pt.efficiency_ = pt.speedup_ / double(pt.num_workers_);
+        }
+        mark_knee(cur_points, knee_gain);
+        points.insert(points.end(), cur_points.begin(), cur_points.end());
+    }
+
+    std::vector<std::string> columns{"placement", "workers", "reps", "median_ms", "stddev_ms",
+            "min_ms", "max_ms", "speedup", "efficiency", "oversubscribed", "knee"};
+#if PERF_COUNTERS_ENABLE
+    columns.insert(columns.end(), {"ipc", "llc_mpki", "ctx_switches_per_task"});
+#endif
+    results_table table{columns};
+    for (const auto& pt : points) {
+        table.row()
+                .add(to_string(pt.placement_))
+                .add(pt.num_workers_)
+                .add(pt.stats_.count_)
+                .add(pt.stats_.median_)
+                .add(pt.stats_.stddev_)
+                .add(pt.stats_.min_)
+                .add(pt.stats_.max_)
+                .add(pt.speedup_)
+                .add(pt.efficiency_)
+                .add(pt.oversubscribed_)
+                .add(pt.knee_);
+#if PERF_COUNTERS_ENABLE
+        const auto& v = pt.work_counters_.counters_.vals_;
+        double instr = double(v[perf_counters::instructions]);
+        double cycles = double(v[perf_counters::cycles]);
+        table.add(cycles > 0 ? instr / cycles : 0.0)
+                .add(instr > 0 ? double(v[perf_counters::llc_misses]) * 1000.0 / instr : 0.0)
+                .add(pt.work_counters_.calls_
+                                ? double(v[perf_counters::context_switches]) /
+                                          double(pt.work_counters_.calls_)
+                                : 0.0);
+#endif
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
 
+    cmd_line args{argc, argv};
+    if (args.has("sweep")) {
+        scaling_sweep(args);
+        return 0;
+    }
+
     double t1 = run_test(1);
     printf("Time 1 thread: %g\n", t1);
     fflush(stdout);
@@ -95,7 +276,10 @@ int main() {
     //      Time 6 threads: 3760.39; speedup=5.78
     //      Time 8 threads: 3354.62; speedup=6.48
     //      Time 12 threads: 3032.51; speedup=7.17
-    //      Time 24 threads: 3052.63; speedup=7.12    
+    //      Time 24 threads: 3052.63; speedup=7.12
+    //
+    // Single runs are noisy; use `--sweep` to get statistically meaningful numbers
 
     return 0;
 }
+#endif
@@ -4,8 +4,15 @@
 
 #include "../common/utils.hpp"
 #include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
 
 #include <mutex>
+#include <vector>
+
+namespace {
 
 void serialized_work() {
     CONCORE_PROFILING_FUNCTION();
@@ -17,8 +24,8 @@ void other_work() {
     cpu_busy_work_large_unit();
 }
 
-static constexpr int num_ser_tasks = 30;
-static constexpr int num_other_tasks = 100;
+int num_ser_tasks = 30;
+int num_other_tasks = 100;
 
 void test_serializer() {
     CONCORE_PROFILING_FUNCTION();
@@ -63,10 +70,351 @@ void test_mutex() {
     concore::wait(grp);
 }
 
-int main() {
+//! Hint to the CPU that we are busy-waiting
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+//! Test-and-test-and-set spin lock
+class spin_lock {
+public:
+    void lock() {
+        while (true) {
+            if (!locked_.exchange(true, std::memory_order_acquire))
+                return;
+            while (locked_.load(std::memory_order_relaxed))
+                cpu_relax();
+        }
+    }
+    void unlock() { locked_.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> locked_{false};
+};
+
+//! Ticket lock: FIFO-fair spin lock
+class ticket_lock {
+public:
+    void lock() {
+        auto my_ticket = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+        while (now_serving_.load(std::memory_order_acquire) != my_ticket)
+            cpu_relax();
+    }
+    void unlock() {
+        now_serving_.store(
+                now_serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<uint32_t> next_ticket_{0};
+    std::atomic<uint32_t> now_serving_{0};
+};
+
+//! Flat-combining executor.
+//! Callers publish their operations in a lock-free list; whoever manages to take the combiner lock
+//! executes all the published operations, while the others wait for their operation to be done.
+//! The operations are executed in the order in which they were published.
+class flat_combiner {
+public:
+    template <typename F>
+    void execute(F& f) {
+        request req;
+        req.fn_ = [](void* arg) { (*static_cast<F*>(arg))(); };
+        req.arg_ = &f;
+
+        // Publish the request
+        req.next_ = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(
+                req.next_, &req, std::memory_order_release, std::memory_order_relaxed))
+            ;
+
+        // Wait until some combiner executes our request; try to become the combiner
+        while (!req.done_.load(std::memory_order_acquire)) {
+            if (!combining_.load(std::memory_order_relaxed) &&
+                    !combining_.exchange(true, std::memory_order_acquire)) {
+                combine();
+                combining_.store(false, std::memory_order_release);
+            } else
+                cpu_relax();
+        }
+    }
+
+private:
+    struct request {
+        void (*fn_)(void*){nullptr};
+        void* arg_{nullptr};
+        request* next_{nullptr};
+        std::atomic<bool> done_{false};
+    };
+    std::atomic<request*> head_{nullptr};
+    std::atomic<bool> combining_{false};
+
+    void combine() {
+        request* list = head_.exchange(nullptr, std::memory_order_acquire);
+        // The list is in LIFO order; reverse it
+        request* ordered = nullptr;
+        while (list) {
+            request* next = list->next_;
+            list->next_ = ordered;
+            ordered = list;
+            list = next;
+        }
+        while (ordered) {
+            // Once `done_` is set, the owner may destroy the request; read `next_` before that
+            request* next = ordered->next_;
+            ordered->fn_(ordered->arg_);
+            ordered->done_.store(true, std::memory_order_release);
+            ordered = next;
+        }
+    }
+};
+
+//! The synchronization methods we compare in the contention sweep
+enum class sync_method { serializer, mutex, spin_lock, ticket_lock, flat_combining };
+
+const char* to_string(sync_method m) {
+    switch (m) {
+    case sync_method::serializer:
+        return "serializer";
+    case sync_method::mutex:
+        return "mutex";
+    case sync_method::spin_lock:
+        return "spin_lock";
+    case sync_method::ticket_lock:
+        return "ticket_lock";
+    case sync_method::flat_combining:
+        return "flat_combining";
+    }
+    return "";
+}
+
+//! Parameters of one contention run
+struct contention_params {
+    int num_tasks_{1000};   //!< Total number of tasks
+    double ser_ratio_{0.3}; //!< Fraction of the tasks that need serialized access
+    int cs_units_{100};     //!< Length of the critical section, in work units
+    int other_units_{1000}; //!< Length of the independent tasks, in work units
+};
+
+//! Spawns the tasks of a contention run; the serialized and the independent tasks are interleaved.
+//! `spawn_serialized` is called to spawn each task needing serialized access.
+template <typename SpawnSer>
+void spawn_mixed_tasks(
+        const contention_params& p, concore::task_group& grp, SpawnSer&& spawn_serialized) {
+    int other_units = p.other_units_;
+    for (int i = 0; i < p.num_tasks_; i++) {
+        // Spread the serialized tasks evenly among the other tasks
+        bool is_ser = int((i + 1) * p.ser_ratio_) > int(i * p.ser_ratio_);
+        if (is_ser)
+            spawn_serialized();
+        else
+            concore::spawn(concore::task{[other_units] { do_work_units(other_units); }, grp});
+    }
+}
+
+//! Runs the tasks using a lock to protect the critical section
+template <typename Lock>
+void run_with_lock(const contention_params& p, concore::task_group& grp, Lock& lock) {
+    int cs_units = p.cs_units_;
+    spawn_mixed_tasks(p, grp, [&] {
+        auto f = [&lock, cs_units] {
+            std::scoped_lock<Lock> guard{lock};
+            do_work_units(cs_units);
+        };
+        concore::spawn(concore::task{f, grp});
+    });
+    concore::wait(grp);
+}
+
+//! Runs one contention test with the given method; returns the elapsed time in ms.
+//! Everything runs on the worker threads; this thread just waits for the result.
+double run_contention_test(sync_method method, const contention_params& p) {
+    CONCORE_PROFILING_FUNCTION();
+    double res{0};
+    std::atomic<bool> done{false};
+    concore::spawn([&] {
+        auto grp = concore::task_group::create();
+        int cs_units = p.cs_units_;
+        res = time_ms([&] {
+            switch (method) {
+            case sync_method::serializer: {
+                concore::serializer ser;
+                spawn_mixed_tasks(p, grp, [&] {
+                    ser.execute(concore::task{[cs_units] { do_work_units(cs_units); }, grp});
+                });
+                concore::wait(grp);
+                break;
+            }
+            case sync_method::mutex: {
+                std::mutex m;
+                run_with_lock(p, grp, m);
+                break;
+            }
+            case sync_method::spin_lock: {
+                spin_lock l;
+                run_with_lock(p, grp, l);
+                break;
+            }
+            case sync_method::ticket_lock: {
+                ticket_lock l;
+                run_with_lock(p, grp, l);
+                break;
+            }
+            case sync_method::flat_combining: {
+                flat_combiner comb;
+                spawn_mixed_tasks(p, grp, [&] {
+                    auto f = [&comb, cs_units] {
+                        auto cs = [cs_units] { do_work_units(cs_units); };
+                        comb.execute(cs);
+                    };
+                    concore::spawn(concore::task{f, grp});
+                });
+                concore::wait(grp);
+                break;
+            }
+            }
+        });
+        done = true;
+    });
+    while (!done.load())
+        sleep_for(1ms);
+    return res;
+}
+
+bench_registrar serializer_registrar{{
+        "serializer",
+        "serialized tasks mixed with other tasks, with a serializer and with a mutex",
+        {{{"workers", 3}, {"ser_tasks", 30}, {"other_tasks", 100}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            num_ser_tasks = p.get_int("ser_tasks");
+            num_other_tasks = p.get_int("other_tasks");
+            m.add("serializer_ms", time_ms(test_serializer));
+            m.add("mutex_ms", time_ms(test_mutex));
+        },
+}};
+
+bench_registrar contention_registrar{{
+        "serializer_contention",
+        "compare the ways of protecting shared state, for one contention level",
+        {{{"workers", 0}, {"tasks", 1000}, {"ser_pct", 25}, {"cs_units", 100},
+                {"other_units", 1000}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            contention_params cp;
+            cp.num_tasks_ = p.get_int("tasks");
+            cp.ser_ratio_ = p.get("ser_pct") / 100.0;
+            cp.cs_units_ = p.get_int("cs_units");
+            cp.other_units_ = p.get_int("other_units");
+            for (auto method : {sync_method::serializer, sync_method::mutex,
+                         sync_method::spin_lock, sync_method::ticket_lock,
+                         sync_method::flat_combining})
+                m.add(std::string(to_string(method)) + "_ms", run_contention_test(method, cp));
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Parameterized contention benchmark.
+//! Varies the ratio of serialized work, the length of the critical section and the number of
+//! workers, and compares different ways of protecting the shared state. For each configuration
+//! it reports the throughput and the fraction of time the workers were not doing useful work
+//! (idle, blocked or spinning).
+//!
+//! Options:
+//!     --workers LIST      worker counts to test (default: 1,2,4,hardware concurrency)
+//!     --ratios LIST       percentages of serialized tasks (default: 5,25,50)
+//!     --cs-units LIST     critical section lengths, in work units (default: 10,100,1000)
+//!     --other-units N     length of the independent tasks, in work units (default: 1000)
+//!     --tasks N           total number of tasks per run (default: 1000)
+//!     --reps N            repetitions of each run; we take the median (default: 3)
+//!     --format F          text, csv or json (default: text)
+void contention_sweep(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    auto workers = args.get_int_list("workers");
+    if (workers.empty())
+        workers = {1, 2, 4, int(std::thread::hardware_concurrency())};
+    auto ratios = args.get_int_list("ratios");
+    if (ratios.empty())
+        ratios = {5, 25, 50};
+    auto cs_lengths = args.get_int_list("cs-units");
+    if (cs_lengths.empty())
+        cs_lengths = {10, 100, 1000};
+    int reps = std::max(1, args.get_int("reps", 3));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    // How much a work unit costs, when executed serially
+    double unit_ms = calibrate_cpu_work().ns_per_unit_ * 1e-6;
+
+    const sync_method methods[] = {sync_method::serializer, sync_method::mutex,
+            sync_method::spin_lock, sync_method::ticket_lock, sync_method::flat_combining};
+
+    results_table table{{"method", "workers", "ser_pct", "cs_units", "median_ms", "stddev_ms",
+            "throughput_tasks_per_s", "useful_ms", "idle_ms_per_worker", "idle_pct"}};
+    for (int num_workers : workers) {
+        set_num_workers(num_workers);
+
+        for (int ratio : ratios) {
+            for (int cs_units : cs_lengths) {
+                contention_params p;
+                p.num_tasks_ = args.get_int("tasks", p.num_tasks_);
+                p.other_units_ = args.get_int("other-units", p.other_units_);
+                p.ser_ratio_ = ratio / 100.0;
+                p.cs_units_ = cs_units;
+
+                int num_ser = int(p.num_tasks_ * p.ser_ratio_);
+                double useful_ms =
+                        (double(num_ser) * p.cs_units_ +
+                                double(p.num_tasks_ - num_ser) * p.other_units_) *
+                        unit_ms;
+
+                for (auto method : methods) {
+                    std::vector<double> samples;
+                    for (int r = 0; r < reps; r++)
+                        samples.push_back(run_contention_test(method, p));
+                    auto st = compute_stats(std::move(samples));
+                    double available_ms = st.median_ * num_workers;
+                    double idle_ms = std::max(0.0, available_ms - useful_ms);
+                    table.row()
+                            .add(to_string(method))
+                            .add(num_workers)
+                            .add(ratio)
+                            .add(cs_units)
+                            .add(st.median_)
+                            .add(st.stddev_)
+                            .add(p.num_tasks_ * 1000.0 / st.median_)
+                            .add(useful_ms)
+                            .add(idle_ms / num_workers)
+                            .add(100.0 * idle_ms / available_ms);
+                }
+            }
+        }
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
 
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    if (args.has("sweep")) {
+        contention_sweep(args);
+        return 0;
+    }
+
     // Don't kill the CPU while presenting this live
     concore::init_data config;
     config.num_workers_ = 3;
@@ -78,6 +426,8 @@ int main() {
     // Things to notice:
     // - using serializers can achieve maximum throughput
     // - locks are bottlenecks
+    // - use `--sweep` to compare against other locks and flat combining, under various loads
 
     return 0;
 }
+#endif
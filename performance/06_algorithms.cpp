@@ -5,30 +5,40 @@
 
 #include "../common/utils.hpp"
 #include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
 
 #include <vector>
 
+namespace {
+
+//! How long the transform and the reduce operations take
+std::chrono::duration<double, std::milli> transform_dur = 500ms;
+std::chrono::duration<double, std::milli> reduce_dur = 200ms;
+
 double transform_work_1(int idx) {
     CONCORE_PROFILING_FUNCTION();
-    sleep_for(500ms);
+    sleep_for(transform_dur);
     return double(idx);
 }
 
 double transform_work_2(int idx) {
     CONCORE_PROFILING_FUNCTION();
-    sleep_for(500ms);
+    sleep_for(transform_dur);
     return double(idx);
 }
 
 double reduce_work_1(double l, double r) {
     CONCORE_PROFILING_FUNCTION();
-    sleep_for(200ms);
+    sleep_for(reduce_dur);
     return l + r;
 }
 
 double reduce_work_2(double l, double r) {
     CONCORE_PROFILING_FUNCTION();
-    sleep_for(200ms);
+    sleep_for(reduce_dur);
     return l + r;
 }
 
@@ -55,10 +65,215 @@ double test_fusion(const std::vector<int>& vals) {
     return concore::conc_reduce(vals.begin(), vals.end(), 0.0, fuse_op, reduce_work_2);
 }
 
-int main() {
+//! Background load that keeps a number of tasks running on the workers, until stopped.
+//! Each background task performs a chunk of work (CPU-bound or sleeping), then respawns itself.
+class background_load {
+public:
+    background_load(int num_tasks, double task_ms, bool cpu_bound)
+        : task_ms_(task_ms)
+        , cpu_bound_(cpu_bound) {
+        running_ = true;
+        for (int i = 0; i < num_tasks; i++)
+            spawn_one();
+    }
+    ~background_load() {
+        // Stop respawning and wait for the tasks in flight to finish
+        running_ = false;
+        while (active_.load() > 0)
+            sleep_for(1ms);
+    }
+
+private:
+    double task_ms_;
+    bool cpu_bound_;
+    std::atomic<bool> running_{false};
+    std::atomic<int> active_{0};
+
+    void spawn_one() {
+        active_++;
+        concore::spawn([this] {
+            CONCORE_PROFILING_SCOPE_N("background task");
+            auto dur = std::chrono::duration<double, std::milli>(task_ms_);
+            if (cpu_bound_)
+                do_work_for(dur);
+            else
+                sleep_for(dur);
+            if (running_)
+                spawn_one();
+            active_--;
+        });
+    }
+};
+
+//! Runs `conc_reduce` over the values, with `units` of work per element
+double run_reduce(const std::vector<int>& vals, int units) {
+    CONCORE_PROFILING_FUNCTION();
+    auto op = [units](double lhs, int rhs) -> double {
+        do_work_units(units);
+        return lhs + rhs;
+    };
+    auto reduction = [](double lhs, double rhs) -> double { return lhs + rhs; };
+    return concore::conc_reduce(vals.begin(), vals.end(), 0.0, op, reduction);
+}
+
+//! Runs `conc_for` over the values, with `units` of work per element
+void run_for(const std::vector<int>& vals, std::vector<double>& out, int units) {
+    CONCORE_PROFILING_FUNCTION();
+    auto f = [&, units](int i) {
+        do_work_units(units);
+        out[i] = double(vals[i]);
+    };
+    concore::conc_for(0, int(vals.size()), f);
+}
+
+bench_registrar algorithms_registrar{{
+        "algorithms",
+        "transform followed by reduce, as two algorithms and fused in one",
+        {{{"workers", 0}, {"elements", 40}, {"transform_ms", 500}, {"reduce_ms", 200}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            transform_dur = std::chrono::duration<double, std::milli>(p.get("transform_ms"));
+            reduce_dur = std::chrono::duration<double, std::milli>(p.get("reduce_ms"));
+            std::vector<int> v(p.get_int("elements"));
+            for (int i = 0; i < int(v.size()); i++)
+                v[i] = i;
+            m.add("sequence_ms", time_ms([&] { test_sequence(v); }));
+            m.add("fusion_ms", time_ms([&] { test_fusion(v); }));
+        },
+}};
+
+bench_registrar latency_registrar{{
+        "algorithms_latency",
+        "completion latency of conc_reduce and conc_for under background load",
+        {{{"workers", 0}, {"elements", 1000}, {"elem_units", 10}, {"runs", 200}, {"gap_ms", 1},
+                {"bg_tasks", 8}, {"bg_task_ms", 5}, {"bg_cpu", 1}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            int num_elements = p.get_int("elements");
+            int elem_units = p.get_int("elem_units");
+            auto gap = std::chrono::duration<double, std::milli>(p.get("gap_ms"));
+            std::vector<int> vals(num_elements);
+            for (int i = 0; i < num_elements; i++)
+                vals[i] = i;
+            std::vector<double> out(num_elements);
+
+            background_load load{p.get_int("bg_tasks"), p.get("bg_task_ms"), p.get("bg_cpu") != 0};
+            std::vector<double> reduce_lat;
+            std::vector<double> for_lat;
+            for (int i = 0; i < p.get_int("runs"); i++) {
+                reduce_lat.push_back(time_ms([&] { run_reduce(vals, elem_units); }));
+                sleep_for(gap);
+                for_lat.push_back(time_ms([&] { run_for(vals, out, elem_units); }));
+                sleep_for(gap);
+            }
+            m.add("reduce_p50_ms", percentile(reduce_lat, 50));
+            m.add("reduce_p99_ms", percentile(reduce_lat, 99));
+            m.add("for_p50_ms", percentile(for_lat, 50));
+            m.add("for_p99_ms", percentile(for_lat, 99));
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Measures the completion latency of parallel algorithms while background work is present.
+//!
+//! For each background load level, the algorithms are executed repeatedly, with a small gap
+//! between runs (as requests would arrive), and we report the p50/p90/p99/max completion latency.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --algo A            reduce, for or both (default: both)
+//!     --runs N            how many times to run each algorithm per load level (default: 200)
+//!     --elements N        number of elements to process (default: 1000)
+//!     --elem-units N      work units per element (default: 10)
+//!     --gap-ms X          pause between algorithm runs (default: 1)
+//!     --bg-tasks LIST     number of concurrent background tasks (default: 0,2,8,32)
+//!     --bg-task-ms X      duration of one background task (default: 5)
+//!     --bg-kind K         cpu or sleep (default: cpu)
+//!     --format F          text, csv or json (default: text)
+void latency_under_load(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    if (args.has("workers")) {
+        concore::init_data config;
+        config.num_workers_ = args.get_int("workers", 0);
+        concore::init(config);
+    }
+
+    std::string algo = args.get("algo", "both");
+    int runs = std::max(1, args.get_int("runs", 200));
+    int num_elements = args.get_int("elements", 1000);
+    int elem_units = args.get_int("elem-units", 10);
+    auto gap = std::chrono::duration<double, std::milli>(args.get_double("gap-ms", 1));
+    auto bg_levels = args.get_int_list("bg-tasks");
+    if (bg_levels.empty())
+        bg_levels = {0, 2, 8, 32};
+    double bg_task_ms = args.get_double("bg-task-ms", 5);
+    bool bg_cpu = args.get("bg-kind", "cpu") != "sleep";
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    std::vector<int> vals(num_elements);
+    for (int i = 0; i < num_elements; i++)
+        vals[i] = i;
+    std::vector<double> out(num_elements);
+
+    results_table table{{"algo", "bg_tasks", "bg_kind", "runs", "mean_ms", "p50_ms", "p90_ms",
+            "p99_ms", "max_ms"}};
+    auto report = [&](const char* name, int bg_tasks, std::vector<double> lat) {
+        std::sort(lat.begin(), lat.end());
+        auto st = compute_stats(lat);
+        table.row()
+                .add(name)
+                .add(bg_tasks)
+                .add(bg_cpu ? "cpu" : "sleep")
+                .add(st.count_)
+                .add(st.mean_)
+                .add(percentile_sorted(lat, 50))
+                .add(percentile_sorted(lat, 90))
+                .add(percentile_sorted(lat, 99))
+                .add(st.max_);
+    };
+
+    for (int bg_tasks : bg_levels) {
+        background_load load{bg_tasks, bg_task_ms, bg_cpu};
+
+        if (algo == "reduce" || algo == "both") {
+            std::vector<double> lat;
+            for (int i = 0; i < runs; i++) {
+                lat.push_back(time_ms([&] { run_reduce(vals, elem_units); }));
+                sleep_for(gap);
+            }
+            report("conc_reduce", bg_tasks, std::move(lat));
+        }
+        if (algo == "for" || algo == "both") {
+            std::vector<double> lat;
+            for (int i = 0; i < runs; i++) {
+                lat.push_back(time_ms([&] { run_for(vals, out, elem_units); }));
+                sleep_for(gap);
+            }
+            report("conc_for", bg_tasks, std::move(lat));
+        }
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
     profiling_sleep profiling_helper;
     CONCORE_PROFILING_FUNCTION();
 
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    if (args.has("latency")) {
+        latency_under_load(args);
+        return 0;
+    }
+
     // Create the initial vector of elements
     std::vector<int> v;
     for (int i = 0; i < 40; i++)
@@ -90,6 +305,8 @@ int main() {
     // - algorithms composabiliy is not great
     // - better to fuse algorithms
     // - latency problems in the presence of other work
+    //   (use `--latency` to measure the latency distribution under a configurable load)
 
     return 0;
 }
+#endif
@@ -0,0 +1,208 @@
+#include <concore/spawn.hpp>
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/fork_join.hpp"
+#include "../common/alloc_counter.hpp"
+
+#include <vector>
+
+#ifndef BENCH_DRIVER
+ALLOC_COUNTER_DEFINE_OPERATORS
+#endif
+
+namespace {
+
+// The recursive divide-and-conquer from `concurrency-tutorial/05_fork_join.cpp`, in three
+// flavors; each of them splits the range in two until it reaches a single element.
+
+//! Forks with `spawn_and_wait` and an initializer list of functions
+template <typename F>
+void apply_spawn_and_wait(int start, int end, F f) {
+    if (end - start <= 1)
+        for (int i = start; i < end; i++)
+            f(i);
+    else {
+        int mid = start + (end - start) / 2;
+        concore::spawn_and_wait({
+                [=] { apply_spawn_and_wait(start, mid, f); },
+                [=] { apply_spawn_and_wait(mid, end, f); } //
+        });
+    }
+}
+
+//! Forks by creating a task group at every level
+template <typename F>
+void apply_task_group(int start, int end, F f) {
+    if (end - start <= 1)
+        for (int i = start; i < end; i++)
+            f(i);
+    else {
+        int mid = start + (end - start) / 2;
+        auto grp = concore::task_group::create();
+        concore::spawn([=] { apply_task_group(start, mid, f); }, grp);
+        concore::spawn([=] { apply_task_group(mid, end, f); }, grp);
+        concore::wait(grp);
+    }
+}
+
+//! Forks with `fork_join`: closures stay on the stack, task groups are reused
+template <typename F>
+void apply_fork_join(int start, int end, const F& f) {
+    if (end - start <= 1)
+        for (int i = start; i < end; i++)
+            f(i);
+    else {
+        int mid = start + (end - start) / 2;
+        fork_join([&] { apply_fork_join(start, mid, f); }, [&] { apply_fork_join(mid, end, f); });
+    }
+}
+
+enum class fork_variant { spawn_and_wait, task_group, fork_join };
+
+const char* to_string(fork_variant v) {
+    switch (v) {
+    case fork_variant::spawn_and_wait:
+        return "spawn_and_wait";
+    case fork_variant::task_group:
+        return "task_group";
+    case fork_variant::fork_join:
+        return "fork_join";
+    }
+    return "";
+}
+
+//! The result of running a divide-and-conquer once
+struct fork_run {
+    double ms_{0};
+    uint64_t allocations_{0};
+};
+
+//! Runs a divide-and-conquer of the given depth (2^depth leaves), on the worker threads.
+//! Counts the heap allocations made during the run (by any thread).
+fork_run run_variant(fork_variant variant, int depth, int leaf_units) {
+    CONCORE_PROFILING_FUNCTION();
+    int num_leaves = 1 << depth;
+    auto leaf = [leaf_units](int) { do_work_units(leaf_units); };
+
+    fork_run res;
+    std::atomic<bool> done{false};
+    uint64_t allocs_start = alloc_counter::count();
+    concore::spawn([&] {
+        res.ms_ = time_ms([&] {
+            switch (variant) {
+            case fork_variant::spawn_and_wait:
+                apply_spawn_and_wait(0, num_leaves, leaf);
+                break;
+            case fork_variant::task_group:
+                apply_task_group(0, num_leaves, leaf);
+                break;
+            case fork_variant::fork_join:
+                apply_fork_join(0, num_leaves, leaf);
+                break;
+            }
+        });
+        done = true;
+    });
+    while (!done.load())
+        sleep_for(1ms);
+    res.allocations_ = alloc_counter::count() - allocs_start;
+    return res;
+}
+
+const fork_variant all_variants[] = {
+        fork_variant::spawn_and_wait, fork_variant::task_group, fork_variant::fork_join};
+
+bench_registrar registrar{{
+        "fork_join",
+        "recursive divide-and-conquer with spawn_and_wait, task groups and fork_join",
+        {{{"workers", 0}, {"depth", 20}, {"leaf_units", 1}}},
+        [](const bench_params& p) {
+            set_num_workers(p.get_int("workers"));
+            for (auto variant : all_variants)
+                run_variant(variant, p.get_int("depth"), p.get_int("leaf_units"));
+        },
+        [](const bench_params& p, bench_metrics& m) {
+            for (auto variant : all_variants) {
+                auto run = run_variant(variant, p.get_int("depth"), p.get_int("leaf_units"));
+                m.add(std::string(to_string(variant)) + "_ms", run.ms_);
+                m.add(std::string(to_string(variant)) + "_allocs", double(run.allocations_));
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares the three ways of forking, on a recursive divide-and-conquer.
+//! Reports the time and the number of heap allocations per run, and per split.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --depth N           recursion depth; the range has 2^depth elements (default: 20)
+//!     --leaf-units N      work units for each element (default: 1)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void compare_variants(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    int depth = args.get_int("depth", 20);
+    int leaf_units = args.get_int("leaf-units", 1);
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    double num_splits = double((1 << depth) - 1);
+    results_table table{{"variant", "depth", "median_ms", "stddev_ms", "ns_per_split",
+            "allocs_per_run", "allocs_per_split"}};
+    for (auto variant : all_variants) {
+        // The first run warms up the caches of task groups
+        run_variant(variant, depth, leaf_units);
+
+        std::vector<double> samples;
+        uint64_t allocs = 0;
+        for (int r = 0; r < reps; r++) {
+            auto run = run_variant(variant, depth, leaf_units);
+            samples.push_back(run.ms_);
+            allocs += run.allocations_;
+        }
+        auto st = compute_stats(std::move(samples));
+        double allocs_per_run = double(allocs) / reps;
+        table.row()
+                .add(to_string(variant))
+                .add(depth)
+                .add(st.median_)
+                .add(st.stddev_)
+                .add(st.median_ * 1e6 / num_splits)
+                .add(allocs_per_run)
+                .add(allocs_per_run / num_splits);
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    compare_variants(args);
+
+    // Things to notice:
+    // - both spawn_and_wait and per-level task groups allocate at every split
+    // - fork_join doesn't allocate, once the task groups of each nesting level are created
+    // - the difference in time per split
+
+    return 0;
+}
+#endif
@@ -0,0 +1,226 @@
+#include <concore/conc_reduce.hpp>
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/letter_histogram.hpp"
+#include "../common/mapped_file.hpp"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+//! Generates `size` bytes of text: words of mixed case, separated by spaces and punctuation
+std::vector<char> generate_text(size_t size) {
+    CONCORE_PROFILING_FUNCTION();
+    static const char* words[] = {"Happy", "families", "are", "all", "alike;", "every", "unhappy",
+            "family", "is", "unhappy", "in", "its", "own", "way.", "DURING", "the", "whole", "of",
+            "a", "dull,", "dark,", "and", "soundless", "day", "in", "the", "autumn", "of", "the",
+            "year,", "when", "the", "clouds", "hung", "oppressively", "low", "quiz", "jinx", "42"};
+    constexpr int num_words = sizeof(words) / sizeof(words[0]);
+    std::vector<char> res;
+    res.reserve(size);
+    std::mt19937 rnd{42};
+    while (res.size() < size) {
+        const char* w = words[rnd() % num_words];
+        res.insert(res.end(), w, w + strlen(w));
+        res.push_back(rnd() % 16 == 0 ? '\n' : ' ');
+    }
+    res.resize(size);
+    return res;
+}
+
+//! The ways in which we count the letters
+enum class histogram_method {
+    naive,             //!< tolower/isalpha, one thread
+    scalar,            //!< lookup table and sub-histograms, one thread
+    avx2,              //!< AVX2 kernel, one thread
+    reduce_by_value,   //!< conc_reduce over chunks; histograms passed by value
+    parallel_in_place, //!< per-task histograms, accumulated in place
+};
+
+const char* to_string(histogram_method m) {
+    switch (m) {
+    case histogram_method::naive:
+        return "naive";
+    case histogram_method::scalar:
+        return "scalar";
+    case histogram_method::avx2:
+        return "avx2";
+    case histogram_method::reduce_by_value:
+        return "reduce_by_value";
+    case histogram_method::parallel_in_place:
+        return "parallel_in_place";
+    }
+    return "";
+}
+
+//! Histogram passed by value through `conc_reduce`, like `simple_histogram` in
+//! `concurrency-tutorial/07_conc_reduce.cpp`
+struct value_histogram {
+    uint64_t cnt_[num_letters]{};
+};
+
+//! Counts the letters with the given method; returns false if the method is not supported
+bool count_with(histogram_method m, std::string_view text, uint64_t* counts) {
+    CONCORE_PROFILING_FUNCTION();
+    switch (m) {
+    case histogram_method::naive:
+        count_letters_naive(text.data(), text.size(), counts);
+        return true;
+    case histogram_method::scalar:
+        count_letters_scalar(text.data(), text.size(), counts);
+        return true;
+    case histogram_method::avx2:
+#if LETTER_HISTOGRAM_AVX2
+        if (!has_avx2_letter_kernel())
+            return false;
+        count_letters_avx2(text.data(), text.size(), counts);
+        return true;
+#else
+        return false;
+#endif
+    case histogram_method::reduce_by_value: {
+        static constexpr size_t chunk_size = size_t(1) << 16;
+        std::vector<size_t> chunks;
+        for (size_t start = 0; start < text.size(); start += chunk_size)
+            chunks.push_back(start);
+        auto op = [&text](value_histogram lhs, size_t start) {
+            count_letters(text.data() + start, std::min(chunk_size, text.size() - start), lhs.cnt_);
+            return lhs;
+        };
+        auto reduction = [](value_histogram lhs, const value_histogram& rhs) {
+            for (int l = 0; l < num_letters; l++)
+                lhs.cnt_[l] += rhs.cnt_[l];
+            return lhs;
+        };
+        auto res = concore::conc_reduce(
+                chunks.begin(), chunks.end(), value_histogram{}, op, reduction);
+        std::copy(std::begin(res.cnt_), std::end(res.cnt_), counts);
+        return true;
+    }
+    case histogram_method::parallel_in_place:
+        conc_count_letters(text.data(), text.size(), counts);
+        return true;
+    }
+    return false;
+}
+
+const histogram_method all_methods[] = {histogram_method::naive, histogram_method::scalar,
+        histogram_method::avx2, histogram_method::reduce_by_value,
+        histogram_method::parallel_in_place};
+
+//! The text used by the benchmark scenario; generated once
+const std::vector<char>& scenario_text(size_t size) {
+    static std::vector<char> text;
+    if (text.size() != size)
+        text = generate_text(size);
+    return text;
+}
+
+bench_registrar registrar{{
+        "letter_histogram",
+        "letter counting throughput (GB/s) for the scalar, AVX2 and parallel kernels",
+        {{{"workers", 0}, {"mb", 256}}},
+        [](const bench_params& p) {
+            set_num_workers(p.get_int("workers"));
+            scenario_text(size_t(p.get_int("mb")) << 20);
+        },
+        [](const bench_params& p, bench_metrics& m) {
+            const auto& generated = scenario_text(size_t(p.get_int("mb")) << 20);
+            std::string_view text{generated.data(), generated.size()};
+            for (auto method : all_methods) {
+                uint64_t counts[num_letters] = {};
+                bool supported = true;
+                double ms = time_ms([&] { supported = count_with(method, text, counts); });
+                if (supported)
+                    m.add(std::string(to_string(method)) + "_gb_per_s",
+                            double(text.size()) / (ms * 1e6));
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Measures the throughput of the letter-counting methods, in GB/s.
+//! All the methods are checked against the naive one.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --mb N              size of the generated text, in MB (default: 256)
+//!     --file PATH         count the letters of this file instead; the file is memory-mapped
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void measure_throughput(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    std::vector<char> generated;
+    mapped_file file;
+    std::string_view text;
+    if (args.has("file")) {
+        file = mapped_file{args.get("file").c_str()};
+        if (!file.valid())
+            return;
+        text = file.view();
+    } else {
+        generated = generate_text(size_t(args.get_int("mb", 256)) << 20);
+        text = {generated.data(), generated.size()};
+    }
+    size_t size = text.size();
+    uint64_t expected[num_letters] = {};
+    count_letters_naive(text.data(), text.size(), expected);
+
+    results_table table{{"method", "mb", "median_ms", "stddev_ms", "gb_per_s", "correct"}};
+    for (auto m : all_methods) {
+        std::vector<double> samples;
+        bool correct = true;
+        bool supported = true;
+        for (int r = 0; r < reps && supported; r++) {
+            uint64_t counts[num_letters] = {};
+            samples.push_back(time_ms([&] { supported = count_with(m, text, counts); }));
+            correct = correct && std::equal(counts, counts + num_letters, expected);
+        }
+        if (!supported)
+            continue;
+        auto st = compute_stats(std::move(samples));
+        table.row()
+                .add(to_string(m))
+                .add(double(size) / (1 << 20))
+                .add(st.median_)
+                .add(st.stddev_)
+                .add(double(size) / (st.median_ * 1e6))
+                .add(correct);
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    cmd_line args{argc, argv};
+    measure_throughput(args);
+
+    // Things to notice:
+    // - the cost of tolower/isalpha for each character
+    // - the vectorized kernel processes multiple bytes per cycle
+    // - passing histograms by value is cheap only when the chunks are large
+
+    return 0;
+}
+#endif
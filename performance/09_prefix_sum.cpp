@@ -0,0 +1,234 @@
+#include <concore/conc_scan.hpp>
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/parallel_scan.hpp"
+
+#include <numeric>
+#include <string>
+#include <vector>
+
+// Build with PSTL=YES to compare with the parallel algorithms of the standard library
+#if BENCH_STD_PAR
+#include <execution>
+#endif
+
+namespace {
+
+//! The ways in which we compute prefix sums
+enum class scan_method {
+    std_serial,          //!< std::inclusive_scan
+    std_par,             //!< std::inclusive_scan with std::execution::par
+    conc_scan,           //!< concore::conc_scan with a generic operation
+    blocked_inclusive,   //!< conc_inclusive_sum
+    blocked_exclusive,   //!< conc_exclusive_sum
+    blocked_in_place,    //!< conc_inclusive_sum_in_place
+};
+
+const char* to_string(scan_method m) {
+    switch (m) {
+    case scan_method::std_serial:
+        return "std_serial";
+    case scan_method::std_par:
+        return "std_par";
+    case scan_method::conc_scan:
+        return "conc_scan";
+    case scan_method::blocked_inclusive:
+        return "blocked_inclusive";
+    case scan_method::blocked_exclusive:
+        return "blocked_exclusive";
+    case scan_method::blocked_in_place:
+        return "blocked_in_place";
+    }
+    return "";
+}
+
+const scan_method all_methods[] = {scan_method::std_serial, scan_method::std_par,
+        scan_method::conc_scan, scan_method::blocked_inclusive, scan_method::blocked_exclusive,
+        scan_method::blocked_in_place};
+
+//! Small integers, so that the sums are exact for all the types (even for floats)
+template <typename T>
+std::vector<T> generate_values(size_t count) {
+    CONCORE_PROFILING_FUNCTION();
+    std::vector<T> res(count);
+    std::mt19937 rnd{42};
+    for (auto& x : res)
+        x = T(int(rnd() % 7) - 3);
+    return res;
+}
+
+//! Computes the prefix sums of `in` into `out` with the given method. For the in-place method,
+//! `out` must contain a copy of `in`. Returns false if the method is not available.
+template <typename T>
+bool scan_with(scan_method m, const std::vector<T>& in, std::vector<T>& out) {
+    CONCORE_PROFILING_FUNCTION();
+    switch (m) {
+    case scan_method::std_serial:
+        std::inclusive_scan(in.begin(), in.end(), out.begin());
+        return true;
+    case scan_method::std_par:
+#if BENCH_STD_PAR
+        std::inclusive_scan(std::execution::par, in.begin(), in.end(), out.begin());
+        return true;
+#else
+        return false;
+#endif
+    case scan_method::conc_scan:
+        concore::conc_scan(in.begin(), in.end(), out.begin(), T{}, std::plus<T>{});
+        return true;
+    case scan_method::blocked_inclusive:
+        conc_inclusive_sum(in.data(), in.data() + in.size(), out.data());
+        return true;
+    case scan_method::blocked_exclusive:
+        conc_exclusive_sum(in.data(), in.data() + in.size(), out.data());
+        return true;
+    case scan_method::blocked_in_place:
+        conc_inclusive_sum_in_place(out.data(), out.data() + out.size());
+        return true;
+    }
+    return false;
+}
+
+//! Checks the result of a method against the serial inclusive scan
+template <typename T>
+bool check_result(scan_method m, const std::vector<T>& in, const std::vector<T>& expected,
+        const std::vector<T>& out) {
+    if (m != scan_method::blocked_exclusive)
+        return out == expected;
+    for (size_t i = 0; i < in.size(); i++)
+        if (out[i] != expected[i] - in[i])
+            return false;
+    return true;
+}
+
+//! Times one run of the method, in ms; returns a negative value if the method is not available
+template <typename T>
+double time_scan(scan_method m, const std::vector<T>& in, std::vector<T>& out) {
+    if (m == scan_method::blocked_in_place)
+        std::copy(in.begin(), in.end(), out.begin());
+    bool supported = true;
+    double ms = time_ms([&] { supported = scan_with(m, in, out); });
+    return supported ? ms : -1;
+}
+
+template <typename T>
+void measure_type(const char* type_name, size_t count, int reps, results_table& table) {
+    CONCORE_PROFILING_FUNCTION();
+    auto in = generate_values<T>(count);
+    std::vector<T> expected(count);
+    std::inclusive_scan(in.begin(), in.end(), expected.begin());
+
+    std::vector<T> out(count);
+    for (auto m : all_methods) {
+        std::vector<double> samples;
+        bool correct = true;
+        for (int r = 0; r < reps; r++) {
+            double ms = time_scan(m, in, out);
+            if (ms < 0)
+                break;
+            samples.push_back(ms);
+            correct = correct && check_result(m, in, expected, out);
+        }
+        if (samples.empty())
+            continue;
+        auto st = compute_stats(std::move(samples));
+        table.row()
+                .add(type_name)
+                .add(to_string(m))
+                .add(st.median_)
+                .add(st.stddev_)
+                .add(double(count) / (st.median_ * 1e3))
+                .add(double(count * sizeof(T)) / (st.median_ * 1e6))
+                .add(correct);
+    }
+}
+
+//! The data used by the benchmark scenario; generated once
+struct scenario_data {
+    std::vector<int32_t> in_;
+    std::vector<int32_t> out_;
+};
+scenario_data& get_scenario_data(size_t count) {
+    static scenario_data data;
+    if (data.in_.size() != count) {
+        data.in_ = generate_values<int32_t>(count);
+        data.out_.resize(count);
+    }
+    return data;
+}
+
+bench_registrar registrar{{
+        "prefix_sum",
+        "prefix sums of 32-bit integers: blocked SIMD scan vs the standard library and conc_scan",
+        {{{"workers", 0}, {"millions", 64}}},
+        [](const bench_params& p) {
+            set_num_workers(p.get_int("workers"));
+            get_scenario_data(size_t(p.get_int("millions")) * 1000000);
+        },
+        [](const bench_params& p, bench_metrics& m) {
+            auto& data = get_scenario_data(size_t(p.get_int("millions")) * 1000000);
+            for (auto method : all_methods) {
+                double ms = time_scan(method, data.in_, data.out_);
+                if (ms >= 0)
+                    m.add(std::string(to_string(method)) + "_ms", ms);
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares the blocked parallel scan with the scans of the standard library and with the generic
+//! `conc_scan`, for 32-bit integers (SIMD kernel), floats (SIMD kernel) and doubles (scalar
+//! kernel). Reports the throughput, and checks the results against the serial scan.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --millions N        number of elements, in millions (default: 64)
+//!     --type T            int, float or double (default: all of them)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void measure_throughput(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    size_t count = size_t(args.get_int("millions", 64)) * 1000000;
+    std::string type = args.get("type", "all");
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{
+            {"type", "method", "median_ms", "stddev_ms", "m_elems_per_s", "gb_per_s", "correct"}};
+    if (type == "all" || type == "int")
+        measure_type<int32_t>("int", count, reps, table);
+    if (type == "all" || type == "float")
+        measure_type<float>("float", count, reps, table);
+    if (type == "all" || type == "double")
+        measure_type<double>("double", count, reps, table);
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    cmd_line args{argc, argv};
+    measure_throughput(args);
+
+    // Things to notice:
+    // - the generic conc_scan pays for the generality of the operation and of the iterators
+    // - the SIMD kernels help the 32-bit types; doubles use the scalar kernel
+    // - with enough threads, the blocked scan is limited by the memory bandwidth
+
+    return 0;
+}
+#endif
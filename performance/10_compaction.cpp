@@ -0,0 +1,202 @@
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/parallel_compaction.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+//! A column of values, with the head flags that group it into segments
+struct column {
+    std::vector<int32_t> values_;
+    std::vector<uint8_t> heads_;
+};
+
+//! Values in [0, 1000); on average, one segment every `avg_segment` elements
+column generate_column(size_t count, int avg_segment) {
+    CONCORE_PROFILING_FUNCTION();
+    column res;
+    res.values_.resize(count);
+    res.heads_.resize(count);
+    std::mt19937 rnd{42};
+    for (size_t i = 0; i < count; i++) {
+        res.values_[i] = int32_t(rnd() % 1000);
+        res.heads_[i] = i == 0 || rnd() % std::max(1, avg_segment) == 0;
+    }
+    return res;
+}
+
+//! The operations we measure, each one serially and in parallel
+enum class column_op { copy_if, partition, segmented_sum };
+
+const char* to_string(column_op op) {
+    switch (op) {
+    case column_op::copy_if:
+        return "copy_if";
+    case column_op::partition:
+        return "partition";
+    case column_op::segmented_sum:
+        return "segmented_sum";
+    }
+    return "";
+}
+
+const column_op all_ops[] = {column_op::copy_if, column_op::partition, column_op::segmented_sum};
+
+//! Runs the operation on the column, writing to `out`; keeps the values below `threshold`.
+//! Returns the number of elements written to `out`; copy_if leaves the rest of it untouched.
+size_t run_op(column_op op, bool parallel, const column& col, int32_t threshold,
+        std::vector<int32_t>& out) {
+    CONCORE_PROFILING_FUNCTION();
+    const int32_t* first = col.values_.data();
+    const int32_t* last = first + col.values_.size();
+    auto pred = [threshold](int32_t x) { return x < threshold; };
+    switch (op) {
+    case column_op::copy_if:
+        if (parallel)
+            return conc_copy_if(first, last, out.data(), pred);
+        return size_t(std::copy_if(first, last, out.data(), pred) - out.data());
+    case column_op::partition:
+        if (parallel)
+            conc_partition_copy(first, last, out.data(), pred);
+        else {
+            // Serially, we need to know where the second group starts, too
+            size_t num_true = size_t(std::count_if(first, last, pred));
+            std::partition_copy(first, last, out.data(), out.data() + num_true, pred);
+        }
+        break;
+    case column_op::segmented_sum:
+        if (parallel)
+            conc_segmented_scan(first, last, col.heads_.data(), out.data());
+        else {
+            int32_t acc = 0;
+            for (size_t i = 0; i < col.values_.size(); i++) {
+                acc = col.heads_[i] ? first[i] : acc + first[i];
+                out[i] = acc;
+            }
+        }
+        break;
+    }
+    return col.values_.size();
+}
+
+//! The data used by the benchmark scenario; generated once
+struct scenario_data {
+    column col_;
+    std::vector<int32_t> out_;
+};
+scenario_data& get_scenario_data(size_t count) {
+    static scenario_data data;
+    if (data.col_.values_.size() != count) {
+        data.col_ = generate_column(count, 1000);
+        data.out_.resize(count);
+    }
+    return data;
+}
+
+bench_registrar registrar{{
+        "compaction",
+        "parallel copy_if, stable partition and segmented scan vs their serial versions",
+        {{{"workers", 0}, {"millions", 64}, {"selectivity", 50}}},
+        [](const bench_params& p) {
+            set_num_workers(p.get_int("workers"));
+            get_scenario_data(size_t(p.get_int("millions")) * 1000000);
+        },
+        [](const bench_params& p, bench_metrics& m) {
+            auto& data = get_scenario_data(size_t(p.get_int("millions")) * 1000000);
+            auto threshold = int32_t(p.get_int("selectivity") * 10);
+            for (auto op : all_ops) {
+                for (bool parallel : {false, true}) {
+                    double ms = time_ms(
+                            [&] { run_op(op, parallel, data.col_, threshold, data.out_); });
+                    m.add(std::string(to_string(op)) + (parallel ? "_parallel_ms" : "_serial_ms"),
+                            ms);
+                }
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares the parallel compaction, partition and segmented scan with their serial versions.
+//! Reports the throughput, and checks that the parallel results match the serial ones.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --millions N        number of elements, in millions (default: 64)
+//!     --selectivity P     percentage of elements selected by copy_if/partition (default: 50)
+//!     --segment N         average segment length, for the segmented scan (default: 1000)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void measure_throughput(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    size_t count = size_t(args.get_int("millions", 64)) * 1000000;
+    auto threshold = int32_t(args.get_int("selectivity", 50) * 10);
+    int avg_segment = args.get_int("segment", 1000);
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    auto col = generate_column(count, avg_segment);
+    std::vector<int32_t> expected(count);
+    std::vector<int32_t> out(count);
+
+    results_table table{
+            {"operation", "mode", "median_ms", "stddev_ms", "m_elems_per_s", "speedup", "correct"}};
+    for (auto op : all_ops) {
+        size_t expected_count = run_op(op, false, col, threshold, expected);
+        double serial_ms = 0;
+        for (bool parallel : {false, true}) {
+            std::vector<double> samples;
+            bool correct = true;
+            for (int r = 0; r < reps; r++) {
+                size_t out_count = 0;
+                samples.push_back(
+                        time_ms([&] { out_count = run_op(op, parallel, col, threshold, out); }));
+                correct = correct && out_count == expected_count &&
+                          std::equal(out.begin(), out.begin() + out_count, expected.begin());
+            }
+            auto st = compute_stats(std::move(samples));
+            if (!parallel)
+                serial_ms = st.median_;
+            table.row()
+                    .add(to_string(op))
+                    .add(parallel ? "parallel" : "serial")
+                    .add(st.median_)
+                    .add(st.stddev_)
+                    .add(double(count) / (st.median_ * 1e3))
+                    .add(serial_ms / st.median_)
+                    .add(correct);
+        }
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    cmd_line args{argc, argv};
+    measure_throughput(args);
+
+    // Things to notice:
+    // - the parallel versions read the input twice; they need a few cores to pay off
+    // - the selectivity changes the cost of the scatter, but not of the counting
+    // - the segmented scan only re-reads the last segment of each block in the first pass
+
+    return 0;
+}
+#endif
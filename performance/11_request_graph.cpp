@@ -0,0 +1,223 @@
+#include <concore/task_graph.hpp>
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/graph_template.hpp"
+#include "../common/alloc_counter.hpp"
+#include "../common/in_flight_window.hpp"
+
+#include <string>
+#include <vector>
+
+#ifndef BENCH_DRIVER
+ALLOC_COUNTER_DEFINE_OPERATORS
+#endif
+
+namespace {
+
+//! The state of one request
+struct request_ctx {
+    in_flight_window* window_{nullptr};
+    int node_units_{0};
+};
+
+void node_work(request_ctx& r) { do_work_units(r.node_units_); }
+
+//! The shape of the request graph from `concurrency-tutorial/09_task_graph.cpp`: 9 steps and a
+//! final node that marks the request as done. Calls `add_edge(from, to)` for all the edges.
+template <typename AddEdge>
+void request_graph_edges(AddEdge&& add_edge) {
+    add_edge(0, 1);
+    add_edge(0, 2);
+    add_edge(1, 3);
+    add_edge(2, 3);
+    add_edge(2, 4);
+    add_edge(3, 6);
+    add_edge(2, 5);
+    add_edge(4, 5);
+    add_edge(5, 6);
+    add_edge(5, 7);
+    add_edge(5, 8);
+    add_edge(6, 9);
+    add_edge(7, 9);
+    add_edge(8, 9);
+}
+constexpr int num_steps = 9;
+
+//! Builds the graph from scratch, as the tutorial does, and starts it
+void start_chained_request(in_flight_window& window, int node_units) {
+    auto req = std::make_shared<request_ctx>();
+    req->window_ = &window;
+    req->node_units_ = node_units;
+    std::vector<concore::chained_task> tasks;
+    tasks.reserve(num_steps + 1);
+    for (int i = 0; i < num_steps; i++)
+        tasks.emplace_back([req] { node_work(*req); });
+    tasks.emplace_back([req] { req->window_->release(); });
+    request_graph_edges([&](int from, int to) { concore::add_dependency(tasks[from], tasks[to]); });
+    concore::spawn(tasks[0]);
+}
+
+graph_template<request_ctx> make_request_template() {
+    graph_template<request_ctx> g;
+    for (int i = 0; i < num_steps; i++)
+        g.add_node("step" + std::to_string(i), node_work);
+    g.add_node("done", [](request_ctx& r) { r.window_->release(); });
+    request_graph_edges([&](int from, int to) { g.add_edge(from, to); });
+    return g;
+}
+
+enum class graph_variant { chained_tasks, pooled_template };
+
+const char* to_string(graph_variant v) {
+    switch (v) {
+    case graph_variant::chained_tasks:
+        return "chained_tasks";
+    case graph_variant::pooled_template:
+        return "pooled_template";
+    }
+    return "";
+}
+
+const graph_variant all_variants[] = {graph_variant::chained_tasks, graph_variant::pooled_template};
+
+//! The result of handling a batch of requests
+struct requests_run {
+    double ms_{0};
+    uint64_t allocations_{0};
+    int pool_size_{0};
+};
+
+//! Handles `num_requests` requests, at most `in_flight` at a time; this thread starts the requests,
+//! the workers execute them
+requests_run run_requests(graph_variant variant, int num_requests, int in_flight, int node_units) {
+    CONCORE_PROFILING_FUNCTION();
+    static const auto tmpl = make_request_template();
+    // The pool lives as long as the program, as a server's would; the first run fills it
+    static graph_pool<request_ctx> pool{tmpl};
+
+    in_flight_window window{in_flight};
+    requests_run res;
+    uint64_t allocs_start = alloc_counter::count();
+    res.ms_ = time_ms([&] {
+        for (int i = 0; i < num_requests; i++) {
+            window.acquire();
+            if (variant == graph_variant::chained_tasks)
+                start_chained_request(window, node_units);
+            else {
+                auto& inst = pool.acquire();
+                inst.context().window_ = &window;
+                inst.context().node_units_ = node_units;
+                inst.start();
+            }
+        }
+        window.wait_all();
+    });
+    // The last node releases the window slot just before the instance goes back to the pool
+    while (pool.num_free() != pool.size())
+        std::this_thread::yield();
+    res.allocations_ = alloc_counter::count() - allocs_start;
+    res.pool_size_ = pool.size();
+    return res;
+}
+
+bench_registrar registrar{{
+        "request_graph",
+        "requests/s for per-request chained_task graphs vs pooled graph-template instances",
+        {{{"workers", 0}, {"requests", 100000}, {"in_flight", 256}, {"node_units", 0}}},
+        [](const bench_params& p) {
+            set_num_workers(p.get_int("workers"));
+            for (auto variant : all_variants)
+                run_requests(variant, std::min(p.get_int("requests"), 10 * p.get_int("in_flight")),
+                        p.get_int("in_flight"), p.get_int("node_units"));
+        },
+        [](const bench_params& p, bench_metrics& m) {
+            for (auto variant : all_variants) {
+                auto run = run_requests(variant, p.get_int("requests"), p.get_int("in_flight"),
+                        p.get_int("node_units"));
+                m.add(std::string(to_string(variant)) + "_requests_per_s",
+                        p.get_int("requests") / (run.ms_ / 1000));
+                m.add(std::string(to_string(variant)) + "_allocs",
+                        double(run.allocations_) / p.get_int("requests"));
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares building the request graph for every request with instantiating a graph template from
+//! a pool. Reports the requests per second, and the heap allocations per request.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --requests N        number of requests (default: 100000)
+//!     --in-flight N       maximum number of requests in flight (default: 256)
+//!     --node-units N      work units for each node of the graph (default: 0)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void compare_variants(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    int num_requests = std::max(1, args.get_int("requests", 100000));
+    int in_flight = std::max(1, args.get_int("in-flight", 256));
+    int node_units = args.get_int("node-units", 0);
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{{"variant", "requests", "median_ms", "stddev_ms", "requests_per_s",
+            "ns_per_request", "allocs_per_request", "pool_size"}};
+    for (auto variant : all_variants) {
+        // Warm up; for the pooled variant, this also fills the pool
+        run_requests(variant, std::min(num_requests, 10 * in_flight), in_flight, node_units);
+
+        std::vector<double> samples;
+        uint64_t allocs = 0;
+        int pool_size = 0;
+        for (int r = 0; r < reps; r++) {
+            auto run = run_requests(variant, num_requests, in_flight, node_units);
+            samples.push_back(run.ms_);
+            allocs += run.allocations_;
+            pool_size = run.pool_size_;
+        }
+        auto st = compute_stats(std::move(samples));
+        table.row()
+                .add(to_string(variant))
+                .add(num_requests)
+                .add(st.median_)
+                .add(st.stddev_)
+                .add(num_requests / (st.median_ / 1000))
+                .add(st.median_ * 1e6 / num_requests)
+                .add(double(allocs) / (double(reps) * num_requests))
+                .add(variant == graph_variant::pooled_template ? pool_size : 0);
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    compare_variants(args);
+
+    // Things to notice:
+    // - building the graph allocates for every node, edge and closure, for every request
+    // - the pooled instances only allocate while the pool grows
+    // - the difference in requests/s, when the nodes themselves are cheap
+
+    return 0;
+}
+#endif
@@ -0,0 +1,207 @@
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/graph_template.hpp"
+#include "../common/in_flight_window.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+//! The state of one request
+struct request_ctx {
+    in_flight_window* window_{nullptr};
+    //! Scales the duration of all the steps
+    double us_per_cost_{1};
+};
+
+//! The request graph from `concurrency-tutorial/09_task_graph.cpp`. The steps do CPU work for a
+//! duration proportional to their cost. If `annotate` is false, all the steps get the same cost,
+//! so the scheduler can only rely on measurements.
+graph_template<request_ctx> make_request_graph(bool annotate) {
+    graph_template<request_ctx> g;
+    auto step = [&](const char* name, double cost) {
+        auto work = [cost](request_ctx& r) { do_work_ns(cost * r.us_per_cost_ * 1000); };
+        return g.add_node(name, work, annotate ? cost : 1.0);
+    };
+    auto read = step("read", 30);
+    auto parse = step("parse", 40);
+    auto auth = step("auth", 7.5);
+    auto log_start = step("log_start", 30);
+    auto alloc = step("alloc", 30);
+    auto compute = step("compute", 60);
+    auto log_end = step("log_end", 30);
+    auto stats = step("stats", 30);
+    auto send = step("send", 30);
+    auto done = g.add_node("done", [](request_ctx& r) { r.window_->release(); }, 0);
+
+    g.add_edges(read, {parse, auth});
+    g.add_edge(parse, log_start);
+    g.add_edges(auth, {log_start, alloc});
+    g.add_edge(log_start, log_end);
+    g.add_edges({auth, alloc}, compute);
+    g.add_edges(compute, {log_end, stats, send});
+    g.add_edges({log_end, stats, send}, done);
+    return g;
+}
+
+//! How we schedule the graphs
+enum class schedule_variant {
+    fifo,           //!< nodes are spawned as they become ready
+    annotated,      //!< critical path first, with the costs given in the template
+    measured,       //!< critical path first, with the costs measured in a first run
+};
+
+const char* to_string(schedule_variant v) {
+    switch (v) {
+    case schedule_variant::fifo:
+        return "fifo";
+    case schedule_variant::annotated:
+        return "critical_path_annotated";
+    case schedule_variant::measured:
+        return "critical_path_measured";
+    }
+    return "";
+}
+
+const schedule_variant all_variants[] = {
+        schedule_variant::fifo, schedule_variant::annotated, schedule_variant::measured};
+
+//! Starts `num_requests` requests from the pool, at most `in_flight` at a time; returns the time
+//! taken by all of them, in ms
+double run_requests(graph_pool<request_ctx>& pool, int num_requests, int in_flight, double us) {
+    CONCORE_PROFILING_FUNCTION();
+    in_flight_window window{in_flight};
+    double ms = time_ms([&] {
+        for (int i = 0; i < num_requests; i++) {
+            window.acquire();
+            auto& inst = pool.acquire();
+            inst.context().window_ = &window;
+            inst.context().us_per_cost_ = us;
+            inst.start();
+        }
+        window.wait_all();
+    });
+    // The last node releases the window slot just before the instance goes back to the pool
+    while (pool.num_free() != pool.size())
+        std::this_thread::yield();
+    return ms;
+}
+
+//! The result of running the requests with one schedule
+struct schedule_run {
+    double ms_{0};
+    graph_timing_stats timing_;
+    double p99_makespan_us_{0};
+};
+
+schedule_run run_variant(schedule_variant variant, int num_requests, int in_flight, double us) {
+    CONCORE_PROFILING_FUNCTION();
+    static const auto annotated_graph = make_request_graph(true);
+    static const auto plain_graph = make_request_graph(false);
+
+    graph_pool_options options;
+    options.schedule_ = variant == schedule_variant::fifo ? graph_schedule::fifo
+                                                          : graph_schedule::critical_path;
+    options.measure_ = true;
+    const auto& graph = variant == schedule_variant::measured ? plain_graph : annotated_graph;
+    graph_pool<request_ctx> pool{graph, in_flight, options};
+    if (variant == schedule_variant::measured) {
+        // Learn the costs of the steps; the plain graph gives all of them the same cost
+        run_requests(pool, std::max(1, num_requests / 10), in_flight, us);
+        pool.use_measured_costs();
+        pool.reset_timing_stats();
+    }
+
+    schedule_run res;
+    res.ms_ = run_requests(pool, num_requests, in_flight, us);
+    res.timing_ = pool.timing_stats();
+    res.p99_makespan_us_ = pool.makespans().percentile_ns(99) / 1000;
+    return res;
+}
+
+bench_registrar registrar{{
+        "critical_path",
+        "makespan of request graphs vs their critical path, with FIFO and critical-path scheduling",
+        {{{"workers", 0}, {"requests", 2000}, {"in_flight", 8}, {"us_per_cost", 2}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            for (auto variant : all_variants) {
+                auto run = run_variant(variant, p.get_int("requests"), p.get_int("in_flight"),
+                        p.get("us_per_cost"));
+                std::string name = to_string(variant);
+                m.add(name + "_mean_makespan_us", run.timing_.mean_makespan_us_);
+                m.add(name + "_mean_ratio", run.timing_.mean_ratio_);
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares the makespan of the request graphs, with and without prioritizing the critical path.
+//! The makespan of a graph is the time from its start to the end of its last node; the critical
+//! path (the lower bound for the makespan) is computed with the measured durations of the nodes.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --requests N        number of requests (default: 2000)
+//!     --in-flight N       maximum number of requests in flight (default: 2 * workers)
+//!     --us-per-cost X     microseconds of CPU work per unit of cost (default: 2)
+//!     --format F          text, csv or json (default: text)
+void compare_schedules(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    int workers = args.get_int("workers", 0);
+    set_num_workers(workers);
+    if (workers <= 0)
+        workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    int num_requests = std::max(1, args.get_int("requests", 2000));
+    int in_flight = std::max(1, args.get_int("in-flight", 2 * workers));
+    double us = args.get_double("us-per-cost", 2);
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{{"schedule", "requests", "requests_per_s", "mean_makespan_us",
+            "p99_makespan_us", "mean_critical_path_us", "mean_ratio", "max_ratio"}};
+    for (auto variant : all_variants) {
+        auto run = run_variant(variant, num_requests, in_flight, us);
+        table.row()
+                .add(to_string(variant))
+                .add(num_requests)
+                .add(num_requests / (run.ms_ / 1000))
+                .add(run.timing_.mean_makespan_us_)
+                .add(run.p99_makespan_us_)
+                .add(run.timing_.mean_critical_path_us_)
+                .add(run.timing_.mean_ratio_)
+                .add(run.timing_.max_ratio_);
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    compare_schedules(args);
+
+    // Things to notice:
+    // - with FIFO, logging and statistics compete with the critical path of the same request
+    // - prioritizing the critical path brings the makespan closer to its lower bound
+    // - measured costs work as well as annotations, without knowing the costs in advance
+
+    return 0;
+}
+#endif
@@ -0,0 +1,247 @@
+#include <concore/conc_for.hpp>
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/alloc_counter.hpp"
+#include "../common/request_arena.hpp"
+
+#include <atomic>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef BENCH_DRIVER
+ALLOC_COUNTER_DEFINE_OPERATORS
+#endif
+
+namespace {
+
+using pmr_header = std::pair<std::pmr::string, std::pmr::string>;
+
+//! The data of a request, as in `concurrency-tutorial/09_task_graph.cpp`, with realistic sizes
+struct request_data {
+    explicit request_data(std::pmr::memory_resource* mem)
+        : uri_(mem)
+        , headers_(mem)
+        , body_(mem)
+        , parsed_body_(mem)
+        , response_(mem) {}
+
+    std::pmr::string uri_;
+    std::pmr::vector<pmr_header> headers_;
+    std::pmr::string body_;
+    std::pmr::vector<pmr_header> parsed_body_;
+    std::pmr::string response_;
+};
+
+//! Reads the request: a URI that doesn't fit in the small-string buffer, 10 headers and a form
+//! body of 1-4KB
+void read_request(request_data& req, int idx) {
+    req.uri_ = "/api/v1/customers/";
+    req.uri_ += std::to_string(idx);
+    req.uri_ += "/orders?limit=50&sort=date";
+    auto* mem = req.headers_.get_allocator().resource();
+    for (int i = 0; i < 10; i++) {
+        pmr_header h{std::pmr::string{"X-Request-Header-", mem}, std::pmr::string{mem}};
+        h.first += std::to_string(i);
+        h.second.assign(24 + i * 4, char('a' + i));
+        req.headers_.push_back(std::move(h));
+    }
+    int body_size = 1024 + (idx % 4) * 1024;
+    while (int(req.body_.size()) < body_size) {
+        req.body_ += "field";
+        req.body_ += std::to_string(req.body_.size());
+        req.body_ += "=some+url+encoded+value&";
+    }
+}
+
+//! Splits the body into key/value pairs
+void parse_body(request_data& req) {
+    auto* mem = req.parsed_body_.get_allocator().resource();
+    std::string_view body = req.body_;
+    while (!body.empty()) {
+        auto amp = body.find('&');
+        auto field = body.substr(0, amp);
+        auto eq = field.find('=');
+        if (eq != std::string_view::npos)
+            req.parsed_body_.emplace_back(std::pmr::string{field.substr(0, eq), mem},
+                    std::pmr::string{field.substr(eq + 1), mem});
+        body = amp == std::string_view::npos ? std::string_view{} : body.substr(amp + 1);
+    }
+}
+
+//! Builds a response of about 1KB
+void compute_response(request_data& req) {
+    req.response_ = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"uri\":\"";
+    req.response_ += req.uri_;
+    req.response_ += "\",\"fields\":[";
+    for (const auto& kv : req.parsed_body_) {
+        if (req.response_.size() > 1000)
+            break;
+        req.response_ += '"';
+        req.response_ += kv.first;
+        req.response_ += "\",";
+    }
+    req.response_ += "]}";
+}
+
+//! Handles one request, with all its data allocated from `mem`; returns the response size
+size_t handle_request(std::pmr::memory_resource* mem, int idx) {
+    request_data req{mem};
+    read_request(req, idx);
+    parse_body(req);
+    compute_response(req);
+    return req.response_.size();
+}
+
+//! Allocates with the global `operator new`, as `std::allocator` does. `new_delete_resource()`
+//! may use the aligned overloads, which the allocation counter doesn't see.
+class heap_resource : public std::pmr::memory_resource {
+    void* do_allocate(size_t bytes, size_t) override { return ::operator new(bytes); }
+    void do_deallocate(void* p, size_t, size_t) override { ::operator delete(p); }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+enum class alloc_variant { heap, arena };
+
+const char* to_string(alloc_variant v) {
+    switch (v) {
+    case alloc_variant::heap:
+        return "heap";
+    case alloc_variant::arena:
+        return "arena";
+    }
+    return "";
+}
+
+const alloc_variant all_variants[] = {alloc_variant::heap, alloc_variant::arena};
+
+//! Each worker keeps one arena for all the requests it handles
+arena_resource& worker_arena() {
+    thread_local arena_resource arena;
+    return arena;
+}
+
+//! The result of handling a batch of requests
+struct requests_run {
+    double ms_{0};
+    uint64_t allocations_{0};
+};
+
+//! Handles `num_requests` requests in parallel, allocating their data from the global heap, or from
+//! the arena of the worker, reset after each request
+requests_run run_requests(alloc_variant variant, int num_requests) {
+    CONCORE_PROFILING_FUNCTION();
+    static heap_resource heap;
+    std::atomic<size_t> total_size{0};
+    requests_run res;
+    uint64_t allocs_start = alloc_counter::count();
+    res.ms_ = time_ms([&] {
+        concore::conc_for(0, num_requests, [&](int i) {
+            size_t size = 0;
+            if (variant == alloc_variant::heap)
+                size = handle_request(&heap, i);
+            else {
+                auto& arena = worker_arena();
+                size = handle_request(&arena, i);
+                arena.reset();
+            }
+            total_size.fetch_add(size, std::memory_order_relaxed);
+        });
+    });
+    res.allocations_ = alloc_counter::count() - allocs_start;
+    return res;
+}
+
+bench_registrar registrar{{
+        "request_arena",
+        "requests/s and allocations/request for request data on the heap vs in per-worker arenas",
+        {{{"workers", 0}, {"requests", 200000}}},
+        [](const bench_params& p) {
+            set_num_workers(p.get_int("workers"));
+            for (auto variant : all_variants)
+                run_requests(variant, std::min(p.get_int("requests"), 10000));
+        },
+        [](const bench_params& p, bench_metrics& m) {
+            for (auto variant : all_variants) {
+                auto run = run_requests(variant, p.get_int("requests"));
+                m.add(std::string(to_string(variant)) + "_requests_per_s",
+                        p.get_int("requests") / (run.ms_ / 1000));
+                m.add(std::string(to_string(variant)) + "_allocs",
+                        double(run.allocations_) / p.get_int("requests"));
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares allocating the data of the requests (strings, headers, parsed body, response) from the
+//! global heap with allocating it from a per-worker arena that is reset after each request.
+//! Reports the requests per second, and the heap allocations per request.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --requests N        number of requests (default: 200000)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void compare_variants(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    int num_requests = std::max(1, args.get_int("requests", 200000));
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{{"variant", "requests", "median_ms", "stddev_ms", "requests_per_s",
+            "ns_per_request", "allocs_per_request"}};
+    for (auto variant : all_variants) {
+        // Warm up; for the arena variant, this also grows the arenas of the workers
+        run_requests(variant, std::min(num_requests, 10000));
+
+        std::vector<double> samples;
+        uint64_t allocs = 0;
+        for (int r = 0; r < reps; r++) {
+            auto run = run_requests(variant, num_requests);
+            samples.push_back(run.ms_);
+            allocs += run.allocations_;
+        }
+        auto st = compute_stats(std::move(samples));
+        table.row()
+                .add(to_string(variant))
+                .add(num_requests)
+                .add(st.median_)
+                .add(st.stddev_)
+                .add(num_requests / (st.median_ / 1000))
+                .add(st.median_ * 1e6 / num_requests)
+                .add(double(allocs) / (double(reps) * num_requests));
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    cmd_line args{argc, argv};
+    compare_variants(args);
+
+    // Things to notice:
+    // - on the heap, every string that outgrows its small buffer and every vector growth allocates
+    // - with the arenas, the requests don't allocate at all, once the arenas are large enough
+    // - the gap in requests/s grows with the number of workers, as they contend on the allocator
+
+    return 0;
+}
+#endif
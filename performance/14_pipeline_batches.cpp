@@ -0,0 +1,231 @@
+#include <concore/pipeline.hpp>
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/batched_pipeline.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+//! A tiny item, like a network packet
+struct packet {
+    int idx_{0};
+    uint64_t value_{0};
+
+    explicit packet(int idx)
+        : idx_(idx) {}
+};
+
+//! The work done by the stages; `work_ns_` for every item in every stage, and the order check
+struct packet_stages {
+    double work_ns_{0};
+    int next_written_{0};
+    bool in_order_{true};
+
+    void parse(packet& p) {
+        do_work_ns(work_ns_);
+        p.value_ = uint64_t(p.idx_);
+    }
+    void transform(packet& p) {
+        do_work_ns(work_ns_);
+        p.value_ *= 3;
+    }
+    void postprocess(packet& p) {
+        do_work_ns(work_ns_);
+        p.value_ += 1;
+    }
+    void write(packet& p) {
+        do_work_ns(work_ns_);
+        in_order_ = in_order_ && p.idx_ == next_written_ && p.value_ == uint64_t(p.idx_) * 3 + 1;
+        next_written_++;
+    }
+};
+
+//! How the pipeline is built. The batched variants use batches for all the stages.
+enum class pipeline_variant { concore_pipeline, batch_1, batch_n };
+
+const char* to_string(pipeline_variant v) {
+    switch (v) {
+    case pipeline_variant::concore_pipeline:
+        return "concore_pipeline";
+    case pipeline_variant::batch_1:
+        return "batched_pipeline_1";
+    case pipeline_variant::batch_n:
+        return "batched_pipeline_n";
+    }
+    return "";
+}
+
+const pipeline_variant all_variants[] = {
+        pipeline_variant::concore_pipeline, pipeline_variant::batch_1, pipeline_variant::batch_n};
+
+//! Runs `f` on all the items of the span
+template <typename F>
+auto for_each_item(F f) {
+    return [f](item_span<packet> items) {
+        for (auto& p : items)
+            f(p);
+    };
+}
+
+//! Pushes `num_items` packets through the pipeline, and waits for them; returns the time taken,
+//! in ms. Sets `correct` if the last stage saw all the items, in order. For the batched variants,
+//! fills `stats` with the measurements of the stages, if given.
+double run_pipeline(pipeline_variant variant, int num_items, int in_flight, size_t batch_size,
+        double work_ns, bool& correct, pipeline_stats* stats = nullptr) {
+    CONCORE_PROFILING_FUNCTION();
+    packet_stages st;
+    st.work_ns_ = work_ns;
+    auto parse = [&st](packet& p) { st.parse(p); };
+    auto transform = [&st](packet& p) { st.transform(p); };
+    auto postprocess = [&st](packet& p) { st.postprocess(p); };
+    auto write = [&st](packet& p) { st.write(p); };
+
+    auto grp = concore::task_group::create();
+    double ms = 0;
+    if (variant == pipeline_variant::concore_pipeline) {
+        ms = time_ms([&] {
+            auto p = concore::pipeline_builder<packet>(in_flight, grp) //
+                     | concore::stage_ordering::in_order               //
+                     | parse                                           //
+                     | concore::stage_ordering::concurrent             //
+                     | transform                                       //
+                     | concore::stage_ordering::out_of_order           //
+                     | postprocess                                     //
+                     | concore::stage_ordering::in_order               //
+                     | write                                           //
+                     | concore::pipeline_end;
+            for (int i = 0; i < num_items; i++)
+                p.push(packet{i});
+            concore::wait(grp);
+        });
+    } else {
+        size_t n = variant == pipeline_variant::batch_1 ? 1 : batch_size;
+        batched_pipeline_builder<packet> builder{in_flight, grp};
+        if (stats)
+            builder.collect_stats();
+        ms = time_ms([&] {
+            auto p = builder                                                           //
+                     | concore::stage_ordering::in_order                               //
+                     | named("parse", in_batches(n, for_each_item(parse)))             //
+                     | concore::stage_ordering::concurrent                             //
+                     | named("transform", in_batches(n, for_each_item(transform)))     //
+                     | concore::stage_ordering::out_of_order                           //
+                     | named("postprocess", in_batches(n, for_each_item(postprocess))) //
+                     | concore::stage_ordering::in_order                               //
+                     | named("write", in_batches(n, for_each_item(write)))             //
+                     | concore::pipeline_end;
+            for (int i = 0; i < num_items; i++)
+                p.push(packet{i});
+            concore::wait(grp);
+            if (stats)
+                *stats = p.stats();
+        });
+    }
+    correct = st.in_order_ && st.next_written_ == num_items;
+    return ms;
+}
+
+bench_registrar registrar{{
+        "pipeline_batches",
+        "items/s through a 4-stage pipeline of tiny items: per-item tasks vs batched stages",
+        {{{"workers", 0}, {"items", 1000000}, {"in_flight", 1024}, {"batch", 64}, {"work_ns", 50}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            for (auto variant : all_variants) {
+                bool correct = false;
+                double ms = run_pipeline(variant, p.get_int("items"), p.get_int("in_flight"),
+                        size_t(p.get_int("batch")), p.get("work_ns"), correct);
+                m.add(std::string(to_string(variant)) + "_m_items_per_s",
+                        p.get_int("items") / (ms * 1e3));
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares a `concore::pipeline`, with one task per item per stage, with a `batched_pipeline`,
+//! with batches of 1 and of N items, for tiny items.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --items N           number of items pushed through the pipeline (default: 1000000)
+//!     --in-flight N       maximum number of items in flight (default: 1024)
+//!     --batch N           batch size, for the batched variant (default: 64)
+//!     --work-ns X         work per item, per stage, in ns (default: 50)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --report            also print the statistics of the stages, for batches of N
+//!     --format F          text, csv or json (default: text)
+void compare_variants(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    int num_items = std::max(1, args.get_int("items", 1000000));
+    int in_flight = std::max(1, args.get_int("in-flight", 1024));
+    auto batch_size = size_t(std::max(1, args.get_int("batch", 64)));
+    double work_ns = args.get_double("work-ns", 50);
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{{"variant", "batch", "items", "median_ms", "stddev_ms", "m_items_per_s",
+            "ns_per_item", "correct"}};
+    for (auto variant : all_variants) {
+        std::vector<double> samples;
+        bool correct = true;
+        for (int r = 0; r < reps; r++) {
+            bool ok = false;
+            samples.push_back(run_pipeline(variant, num_items, in_flight, batch_size, work_ns, ok));
+            correct = correct && ok;
+        }
+        auto st = compute_stats(std::move(samples));
+        table.row()
+                .add(to_string(variant))
+                .add(variant == pipeline_variant::batch_n ? int(batch_size) : 1)
+                .add(num_items)
+                .add(st.median_)
+                .add(st.stddev_)
+                .add(num_items / (st.median_ * 1e3))
+                .add(st.median_ * 1e6 / num_items)
+                .add(correct);
+    }
+    table.print(fmt);
+
+    if (args.has("report")) {
+        bool correct = false;
+        pipeline_stats stats;
+        run_pipeline(pipeline_variant::batch_n, num_items, in_flight, batch_size, work_ns, correct,
+                &stats);
+        print_pipeline_report(stats, fmt);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    compare_variants(args);
+
+    // Things to notice:
+    // - with per-item tasks, the task overhead dominates when the stages are this cheap
+    // - batches of 1 already save tasks: a busy serial stage processes its queue in one task
+    // - larger batches amortize the locking as well; the ordering checks still pass
+    // - with --report: the number of batches per stage, and which stage limits the throughput
+
+    return 0;
+}
+#endif
@@ -0,0 +1,298 @@
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/batched_pipeline.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+//! A frame with a large buffer, as in `concurrency-tutorial/10_pipeline.cpp`
+struct frame_data {
+    int frame_idx_{0};
+    std::vector<char> buffer_;
+
+    frame_data(int idx, size_t size)
+        : frame_idx_(idx)
+        , buffer_(size) {
+        // Touch the memory, so that it's counted in the resident set
+        std::memset(buffer_.data(), idx & 0xff, size);
+    }
+};
+
+//! The resident set size of the process, in bytes
+size_t current_rss() {
+    long pages = 0;
+    if (FILE* f = std::fopen("/proc/self/statm", "r")) {
+        long total = 0;
+        if (std::fscanf(f, "%ld %ld", &total, &pages) != 2)
+            pages = 0;
+        std::fclose(f);
+    }
+    return size_t(pages) * size_t(sysconf(_SC_PAGESIZE));
+}
+
+//! Samples the resident set size in the background, and keeps the maximum
+class rss_sampler {
+public:
+    rss_sampler()
+        : thread_([this] {
+            while (!done_.load()) {
+                size_t rss = current_rss();
+                if (rss > max_rss_.load())
+                    max_rss_.store(rss);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }) {}
+    ~rss_sampler() { stop(); }
+
+    //! Stops sampling; returns the maximum resident set size seen, in bytes
+    size_t stop() {
+        done_ = true;
+        if (thread_.joinable())
+            thread_.join();
+        return max_rss_.load();
+    }
+
+private:
+    std::atomic<bool> done_{false};
+    std::atomic<size_t> max_rss_{0};
+    std::thread thread_;
+};
+
+//! How the producer pushes the frames, and how the pipeline limits them
+enum class push_variant { unbounded, blocking, try_push, async, memory_budget };
+
+const char* to_string(push_variant v) {
+    switch (v) {
+    case push_variant::unbounded:
+        return "unbounded";
+    case push_variant::blocking:
+        return "blocking_push";
+    case push_variant::try_push:
+        return "try_push";
+    case push_variant::async:
+        return "push_async";
+    case push_variant::memory_budget:
+        return "memory_budget";
+    }
+    return "";
+}
+
+const push_variant all_variants[] = {push_variant::blocking, push_variant::try_push,
+        push_variant::async, push_variant::memory_budget, push_variant::unbounded};
+
+//! Makes the allocator give the large buffers back to the system when they are freed. By default,
+//! glibc raises its mmap threshold after the first large free, and then keeps the freed buffers in
+//! the heap, hiding the memory growth of the later runs.
+void return_large_buffers_to_system() {
+#ifdef __GLIBC__
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+#endif
+}
+
+struct backpressure_params {
+    int num_frames_{200};
+    size_t frame_bytes_{1 << 20};
+    double decode_us_{2000};
+    int max_concurrency_{8};
+    size_t queue_capacity_{8};
+
+    //! The memory budget of the `memory_budget` variant
+    size_t memory_budget() const { return size_t(max_concurrency_) * frame_bytes_ * 2; }
+};
+
+//! The most frames that a bounded variant keeps alive at once: the frames that the pipeline
+//! accepts, plus the one the producer holds while it waits. For the unbounded variant, this is
+//! what the queue capacity would allow; it serves as a reference.
+size_t max_live_frames(push_variant variant, const backpressure_params& params) {
+    if (variant == push_variant::memory_budget)
+        return params.memory_budget() / params.frame_bytes_ + 1;
+    return size_t(params.max_concurrency_) + params.queue_capacity_ + 1;
+}
+
+//! The result of pushing all the frames through the pipeline
+struct push_run {
+    double ms_{0};
+    double peak_rss_mb_{0};
+    //! The peak growth we expect with backpressure, plus some slack for the rest of the process
+    //! (task queues, allocator metadata, thread stacks)
+    double rss_bound_mb_{0};
+    bool correct_{false};
+
+    //! True if the memory stayed flat: the peak growth doesn't depend on the number of frames
+    bool flat() const { return peak_rss_mb_ <= rss_bound_mb_; }
+};
+
+//! Produces frames as fast as it can, into a pipeline with a slow, concurrent decode stage
+push_run run_variant(push_variant variant, const backpressure_params& params) {
+    CONCORE_PROFILING_FUNCTION();
+    int next_written = 0;
+    bool in_order = true;
+    auto parse = [](frame_data& frm) { frm.buffer_[0]++; };
+    auto decode = [&params](frame_data&) { do_work_ns(params.decode_us_ * 1000); };
+    auto write = [&](frame_data& frm) {
+        in_order = in_order && frm.frame_idx_ == next_written;
+        next_written++;
+    };
+
+    auto grp = concore::task_group::create();
+    batched_pipeline_builder<frame_data> builder{params.max_concurrency_, grp};
+    if (variant == push_variant::memory_budget)
+        builder.memory_budget(
+                params.memory_budget(), [](const frame_data& frm) { return frm.buffer_.size(); });
+    else if (variant != push_variant::unbounded)
+        builder.queue_capacity(params.queue_capacity_);
+    auto pipeline = builder                                 //
+                    | concore::stage_ordering::in_order     //
+                    | parse                                 //
+                    | concore::stage_ordering::concurrent   //
+                    | decode                                //
+                    | concore::stage_ordering::in_order     //
+                    | write                                 //
+                    | concore::pipeline_end;
+
+    // For `push_async`: each frame is produced in the continuation of the push of the previous one
+    std::function<void(int)> produce = [&](int i) {
+        if (i == params.num_frames_)
+            return;
+        pipeline.push_async(frame_data{i, params.frame_bytes_},
+                concore::task{[&produce, i] { produce(i + 1); }, grp});
+    };
+
+    size_t rss_before = current_rss();
+    rss_sampler sampler;
+    push_run res;
+    res.ms_ = time_ms([&] {
+        switch (variant) {
+        case push_variant::unbounded:
+        case push_variant::blocking:
+        case push_variant::memory_budget:
+            for (int i = 0; i < params.num_frames_; i++)
+                pipeline.push(frame_data{i, params.frame_bytes_});
+            break;
+        case push_variant::try_push:
+            for (int i = 0; i < params.num_frames_; i++) {
+                frame_data frm{i, params.frame_bytes_};
+                // A real producer would do something useful instead of yielding
+                while (!pipeline.try_push(std::move(frm)))
+                    std::this_thread::yield();
+            }
+            break;
+        case push_variant::async:
+            concore::spawn(concore::task{[&produce] { produce(0); }, grp});
+            break;
+        }
+        concore::wait(grp);
+    });
+    size_t peak = sampler.stop();
+    res.peak_rss_mb_ = peak > rss_before ? double(peak - rss_before) / (1 << 20) : 0;
+    res.rss_bound_mb_ =
+            double(max_live_frames(variant, params) * params.frame_bytes_) / (1 << 20) + 4;
+    res.correct_ = in_order && next_written == params.num_frames_;
+    return res;
+}
+
+bench_registrar registrar{{
+        "pipeline_backpressure",
+        "peak memory of a pipeline with a fast producer: unbounded push vs bounded pushes",
+        {{{"workers", 0}, {"frames", 200}, {"frame_kb", 1024}, {"decode_us", 2000}}},
+        [](const bench_params& p) {
+            set_num_workers(p.get_int("workers"));
+            return_large_buffers_to_system();
+        },
+        [](const bench_params& p, bench_metrics& m) {
+            backpressure_params params;
+            params.num_frames_ = p.get_int("frames");
+            params.frame_bytes_ = size_t(p.get_int("frame_kb")) * 1024;
+            params.decode_us_ = p.get("decode_us");
+            for (auto variant : all_variants) {
+                auto run = run_variant(variant, params);
+                m.add(std::string(to_string(variant)) + "_peak_rss_mb", run.peak_rss_mb_);
+                m.add(std::string(to_string(variant)) + "_flat", run.flat() ? 1 : 0);
+                m.add(std::string(to_string(variant)) + "_frames_per_s",
+                        params.num_frames_ / (run.ms_ / 1000));
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Pushes large frames into a pipeline whose decode stage is slower than the producer, with and
+//! without backpressure. Reports the peak growth of the resident set size; with backpressure, it
+//! stays flat, no matter how many frames we push. The `flat` column checks the growth against the
+//! frames that the limits of the variant allow to be alive at once.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --frames N          number of frames (default: 200)
+//!     --frame-kb N        size of the buffer of a frame, in KB (default: 1024)
+//!     --decode-us X       duration of the decode stage, in microseconds (default: 2000)
+//!     --max-concurrency N maximum number of frames in flight (default: 8)
+//!     --capacity N        queue capacity, for the bounded variants (default: 8)
+//!     --format F          text, csv or json (default: text)
+void compare_variants(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    return_large_buffers_to_system();
+    backpressure_params params;
+    params.num_frames_ = std::max(1, args.get_int("frames", 200));
+    params.frame_bytes_ = size_t(std::max(1, args.get_int("frame-kb", 1024))) * 1024;
+    params.decode_us_ = args.get_double("decode-us", 2000);
+    params.max_concurrency_ = std::max(1, args.get_int("max-concurrency", 8));
+    params.queue_capacity_ = size_t(std::max(0, args.get_int("capacity", 8)));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{{"variant", "frames", "ms", "frames_per_s", "peak_rss_growth_mb",
+            "rss_bound_mb", "flat", "correct"}};
+    for (auto variant : all_variants) {
+        auto run = run_variant(variant, params);
+        table.row()
+                .add(to_string(variant))
+                .add(params.num_frames_)
+                .add(run.ms_)
+                .add(params.num_frames_ / (run.ms_ / 1000))
+                .add(run.peak_rss_mb_)
+                .add(run.rss_bound_mb_)
+                .add(run.flat())
+                .add(run.correct_);
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    compare_variants(args);
+
+    // Things to notice:
+    // - without limits, the memory grows with the number of frames pushed
+    // - with any of the bounded pushes, it stays at (max_concurrency + capacity) frames, and the
+    //   variant is reported as flat; the unbounded variant is flat only for a few frames
+    // - the throughput is the same: the decode stage is the bottleneck anyway
+
+    return 0;
+}
+#endif
@@ -0,0 +1,179 @@
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/batched_pipeline.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+struct frame_data {
+    int frame_idx_{0};
+
+    explicit frame_data(int idx)
+        : frame_idx_(idx) {}
+};
+
+//! The durations of the stages, in microseconds
+struct stage_durations {
+    double parse_us_{2};
+    double decode_us_{40};
+    double postprocess_us_{1};
+    double write_us_{2};
+};
+
+//! The result of pushing the frames through the pipeline with one concurrency limit
+struct concurrency_run {
+    double ms_{0};
+    double mean_in_flight_{0};
+    int final_limit_{0};
+    bool correct_{false};
+};
+
+//! Runs the pipeline of `concurrency-tutorial/10_pipeline.cpp`, with CPU work instead of sleeps.
+//! The decode times vary between 0.5x and 1.5x, so the frames get out of order. With `adaptive`,
+//! `max_concurrency` is the upper bound of the adaptive limit.
+concurrency_run run_pipeline(int num_frames, int max_concurrency, bool adaptive, int workers,
+        const stage_durations& d) {
+    CONCORE_PROFILING_FUNCTION();
+    int next_written = 0;
+    bool in_order = true;
+    auto parse = [&d](frame_data&) { do_work_ns(d.parse_us_ * 1000); };
+    auto decode = [&d](frame_data& frm) {
+        double factor = 0.5 + double(frm.frame_idx_ * 7919 % 101) / 100;
+        do_work_ns(d.decode_us_ * 1000 * factor);
+    };
+    auto postprocess = [&d](frame_data&) { do_work_ns(d.postprocess_us_ * 1000); };
+    auto write = [&](frame_data& frm) {
+        do_work_ns(d.write_us_ * 1000);
+        in_order = in_order && frm.frame_idx_ == next_written;
+        next_written++;
+    };
+
+    auto grp = concore::task_group::create();
+    batched_pipeline_builder<frame_data> builder{max_concurrency, grp};
+    builder.collect_stats();
+    if (adaptive)
+        builder.adaptive_concurrency(1, workers);
+    auto pipeline = builder                                         //
+                    | concore::stage_ordering::in_order             //
+                    | named("parse", parse)                         //
+                    | concore::stage_ordering::concurrent           //
+                    | named("decode", decode)                       //
+                    | concore::stage_ordering::out_of_order         //
+                    | named("postprocess", postprocess)             //
+                    | concore::stage_ordering::in_order             //
+                    | named("write", write)                         //
+                    | concore::pipeline_end;
+
+    concurrency_run res;
+    res.ms_ = time_ms([&] {
+        for (int i = 0; i < num_frames; i++)
+            pipeline.push(frame_data{i});
+        concore::wait(grp);
+    });
+    auto st = pipeline.stats();
+    res.mean_in_flight_ = st.mean_in_flight_;
+    res.final_limit_ = st.concurrency_limit_;
+    res.correct_ = in_order && next_written == num_frames;
+    return res;
+}
+
+bench_registrar registrar{{
+        "adaptive_concurrency",
+        "pipeline throughput and frames in flight: fixed limits vs the adaptive limit",
+        {{{"workers", 0}, {"frames", 20000}, {"max_concurrency", 256}, {"decode_us", 40}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            int workers = p.get_int("workers");
+            if (workers <= 0)
+                workers = int(std::max(1u, std::thread::hardware_concurrency()));
+            stage_durations d;
+            d.decode_us_ = p.get("decode_us");
+            int frames = p.get_int("frames");
+            for (bool adaptive : {false, true}) {
+                auto run = run_pipeline(frames, p.get_int("max_concurrency"), adaptive, workers, d);
+                std::string name = adaptive ? "adaptive" : "fixed_max";
+                m.add(name + "_frames_per_s", frames / (run.ms_ / 1000));
+                m.add(name + "_mean_in_flight", run.mean_in_flight_);
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares fixed limits of frames in flight with the adaptive limit. Too low a limit starves the
+//! concurrent decode stage; too high a limit only keeps more frames in memory. The adaptive limit
+//! should get close to the best throughput, with few frames in flight.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --frames N          number of frames (default: 20000)
+//!     --max-concurrency N the largest fixed limit, and the adaptive one's bound (default: 256)
+//!     --parse-us X        duration of the parse stage, in microseconds (default: 2)
+//!     --decode-us X       average duration of the decode stage, in microseconds (default: 40)
+//!     --write-us X        duration of the write stage, in microseconds (default: 2)
+//!     --format F          text, csv or json (default: text)
+void compare_limits(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    int workers = args.get_int("workers", 0);
+    set_num_workers(workers);
+    if (workers <= 0)
+        workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    int num_frames = std::max(1, args.get_int("frames", 20000));
+    int max_concurrency = std::max(1, args.get_int("max-concurrency", 256));
+    stage_durations d;
+    d.parse_us_ = args.get_double("parse-us", 2);
+    d.decode_us_ = args.get_double("decode-us", 40);
+    d.write_us_ = args.get_double("write-us", 2);
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{{"limit", "frames", "ms", "frames_per_s", "mean_in_flight", "final_limit",
+            "correct"}};
+    auto add_row = [&](const std::string& name, const concurrency_run& run) {
+        table.row()
+                .add(name)
+                .add(num_frames)
+                .add(run.ms_)
+                .add(num_frames / (run.ms_ / 1000))
+                .add(run.mean_in_flight_)
+                .add(run.final_limit_)
+                .add(run.correct_);
+    };
+    for (int limit = 1; limit < max_concurrency; limit *= 2)
+        add_row(std::to_string(limit), run_pipeline(num_frames, limit, false, workers, d));
+    add_row(std::to_string(max_concurrency),
+            run_pipeline(num_frames, max_concurrency, false, workers, d));
+    add_row("adaptive", run_pipeline(num_frames, max_concurrency, true, workers, d));
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    compare_limits(args);
+
+    // Things to notice:
+    // - the throughput stops improving once the limit is a bit above the number of workers
+    // - beyond that, larger limits only keep more frames in flight
+    // - the adaptive limit reaches the plateau with few frames in flight, on any number of cores
+
+    return 0;
+}
+#endif
@@ -0,0 +1,214 @@
+#include <concore/init.hpp>
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/alloc_counter.hpp"
+#include "../common/batched_pipeline.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef BENCH_DRIVER
+ALLOC_COUNTER_DEFINE_OPERATORS
+#endif
+
+namespace {
+
+//! A frame with a large buffer, as in `concurrency-tutorial/10_pipeline.cpp`
+struct frame_data {
+    int frame_idx_{0};
+    std::vector<char> buffer_;
+};
+
+//! Reads the content of a frame into its buffer
+void read_frame(frame_data& frm, int idx) {
+    frm.frame_idx_ = idx;
+    std::memset(frm.buffer_.data(), idx & 0xff, frm.buffer_.size());
+}
+
+//! How the producer gets the frames it pushes
+enum class item_variant { new_items, pooled_slots };
+
+const char* to_string(item_variant v) {
+    switch (v) {
+    case item_variant::new_items:
+        return "new_items";
+    case item_variant::pooled_slots:
+        return "pooled_slots";
+    }
+    return "";
+}
+
+const item_variant all_variants[] = {item_variant::new_items, item_variant::pooled_slots};
+
+struct pooled_params {
+    int num_frames_{2000};
+    size_t frame_bytes_{1 << 20};
+    double decode_us_{100};
+    int max_concurrency_{8};
+    size_t queue_capacity_{8};
+};
+
+//! The result of pushing the frames through the pipeline, after warming it up
+struct items_run {
+    double ms_{0};
+    uint64_t allocations_{0};
+    bool correct_{false};
+};
+
+//! Pushes the frames through a pipeline; either a new frame for each push, or a frame from the
+//! pool of the pipeline, filled in place. The same pipeline first processes some frames to warm
+//! up, so that we measure the steady state.
+items_run run_variant(item_variant variant, const pooled_params& params) {
+    CONCORE_PROFILING_FUNCTION();
+    int next_written = 0;
+    bool in_order = true;
+    auto parse = [](frame_data& frm) { frm.buffer_[0]++; };
+    auto decode = [&params](frame_data&) { do_work_ns(params.decode_us_ * 1000); };
+    auto write = [&](frame_data& frm) {
+        in_order = in_order && frm.frame_idx_ == next_written;
+        next_written++;
+    };
+
+    auto grp = concore::task_group::create();
+    auto pipeline = batched_pipeline_builder<frame_data>(params.max_concurrency_, grp) //
+                            .queue_capacity(params.queue_capacity_)                    //
+                    | concore::stage_ordering::in_order                                //
+                    | parse                                                            //
+                    | concore::stage_ordering::concurrent                              //
+                    | decode                                                           //
+                    | concore::stage_ordering::in_order                                //
+                    | write                                                            //
+                    | concore::pipeline_end;
+
+    auto push_frames = [&](int first, int count) {
+        for (int i = first; i < first + count; i++) {
+            if (variant == item_variant::new_items) {
+                frame_data frm;
+                frm.buffer_.resize(params.frame_bytes_);
+                read_frame(frm, i);
+                pipeline.push(std::move(frm));
+            } else {
+                auto slot = pipeline.acquire();
+                // A new slot has no buffer yet; a recycled one keeps its buffer
+                slot->buffer_.resize(params.frame_bytes_);
+                read_frame(*slot, i);
+                pipeline.push(std::move(slot));
+            }
+        }
+        concore::wait(grp);
+    };
+
+    int warmup = params.max_concurrency_ + int(params.queue_capacity_) + 1;
+    push_frames(0, warmup);
+
+    items_run res;
+    uint64_t allocs_start = alloc_counter::count();
+    res.ms_ = time_ms([&] { push_frames(warmup, params.num_frames_); });
+    res.allocations_ = alloc_counter::count() - allocs_start;
+    res.correct_ = in_order && next_written == warmup + params.num_frames_;
+    return res;
+}
+
+bench_registrar registrar{{
+        "pooled_items",
+        "frames/s and allocations/frame through a pipeline: new frames vs pooled item slots",
+        {{{"workers", 0}, {"frames", 2000}, {"frame_kb", 1024}, {"decode_us", 100}}},
+        [](const bench_params& p) { set_num_workers(p.get_int("workers")); },
+        [](const bench_params& p, bench_metrics& m) {
+            pooled_params params;
+            params.num_frames_ = p.get_int("frames");
+            params.frame_bytes_ = size_t(p.get_int("frame_kb")) * 1024;
+            params.decode_us_ = p.get("decode_us");
+            for (auto variant : all_variants) {
+                auto run = run_variant(variant, params);
+                m.add(std::string(to_string(variant)) + "_frames_per_s",
+                        params.num_frames_ / (run.ms_ / 1000));
+                m.add(std::string(to_string(variant)) + "_allocs",
+                        double(run.allocations_) / params.num_frames_);
+            }
+        },
+}};
+
+} // namespace
+
+#ifndef BENCH_DRIVER
+namespace {
+
+//! Compares pushing a new frame, with a new buffer, for each item with acquiring a frame from the
+//! pool of the pipeline and filling it in place. Reports the frames per second, and the heap
+//! allocations per frame, once the pipeline is warm.
+//!
+//! Options:
+//!     --workers N         number of worker threads (default: hardware concurrency)
+//!     --frames N          number of frames (default: 2000)
+//!     --frame-kb N        size of the buffer of a frame, in KB (default: 1024)
+//!     --decode-us X       duration of the decode stage, in microseconds (default: 100)
+//!     --max-concurrency N maximum number of frames in flight (default: 8)
+//!     --capacity N        maximum number of frames waiting to enter the pipeline (default: 8)
+//!     --reps N            repetitions of each measurement; we take the median (default: 5)
+//!     --format F          text, csv or json (default: text)
+void compare_variants(const cmd_line& args) {
+    CONCORE_PROFILING_FUNCTION();
+
+    set_num_workers(args.get_int("workers", 0));
+    pooled_params params;
+    params.num_frames_ = std::max(1, args.get_int("frames", 2000));
+    params.frame_bytes_ = size_t(std::max(1, args.get_int("frame-kb", 1024))) * 1024;
+    params.decode_us_ = args.get_double("decode-us", 100);
+    params.max_concurrency_ = std::max(1, args.get_int("max-concurrency", 8));
+    params.queue_capacity_ = size_t(std::max(0, args.get_int("capacity", 8)));
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    results_table table{{"variant", "frames", "median_ms", "stddev_ms", "frames_per_s",
+            "allocs_per_frame", "correct"}};
+    for (auto variant : all_variants) {
+        std::vector<double> samples;
+        uint64_t allocs = 0;
+        bool correct = true;
+        for (int r = 0; r < reps; r++) {
+            auto run = run_variant(variant, params);
+            samples.push_back(run.ms_);
+            allocs += run.allocations_;
+            correct = correct && run.correct_;
+        }
+        auto st = compute_stats(std::move(samples));
+        table.row()
+                .add(to_string(variant))
+                .add(params.num_frames_)
+                .add(st.median_)
+                .add(st.stddev_)
+                .add(params.num_frames_ / (st.median_ / 1000))
+                .add(double(allocs) / (double(reps) * params.num_frames_))
+                .add(correct);
+    }
+    table.print(fmt);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    calibrate_cpu_work();
+
+    cmd_line args{argc, argv};
+    compare_variants(args);
+
+    // Things to notice:
+    // - with new frames, every frame allocates its buffer, and its line in the pipeline
+    // - with pooled slots, the pipeline doesn't allocate once the pool has enough slots; what's
+    //   left, if anything, comes from the task queues of the executor
+    // - the gap in frames/s depends on how expensive large allocations are; with glibc, buffers
+    //   above the mmap threshold are mapped and unmapped, and page-faulted on every frame
+
+    return 0;
+}
+#endif
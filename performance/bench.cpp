@@ -0,0 +1,178 @@
+//! Benchmark driver: runs the scenarios registered by the examples in this directory.
+//!
+//! Build with `make out/bench`; all the examples are linked in, with their own `main` disabled.
+//!
+//! Options:
+//!     --list              list the scenarios and their parameters, and exit
+//!     --filter LIST       run only the scenarios whose names contain one of the given
+//!                         comma-separated strings (default: all)
+//!     --param N=V         override a parameter; `N` can be `param` (for all the scenarios that
+//!                         have the parameter) or `scenario.param` (takes precedence); can be
+//!                         repeated
+//!     --warmup N          repetitions executed before measuring (default: 1)
+//!     --reps N            measured repetitions (default: 5)
+//!     --format F          text, csv or json (default: text)
+//!
+//! For each scenario we report the statistics of the elapsed time of a repetition (`wall_ms`)
+//! and of all the metrics reported by the scenario, one row per metric.
+
+#include "../common/utils.hpp"
+#include "../common/cpu_work.hpp"
+#include "../common/cmd_line.hpp"
+#include "../common/stats.hpp"
+#include "../common/results_table.hpp"
+#include "../common/bench.hpp"
+#include "../common/alloc_counter.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Count the allocations, for the scenarios that report them
+ALLOC_COUNTER_DEFINE_OPERATORS
+
+namespace {
+
+//! A parameter override given on the command line
+struct param_override {
+    std::string scenario_; //!< Empty if the override applies to all the scenarios
+    std::string name_;
+    double value_{0};
+    bool used_{false};
+};
+
+bool parse_override(const std::string& str, param_override& res) {
+    auto eq = str.find('=');
+    if (eq == std::string::npos || eq == 0)
+        return false;
+    std::string name = str.substr(0, eq);
+    auto dot = name.rfind('.');
+    if (dot != std::string::npos) {
+        res.scenario_ = name.substr(0, dot);
+        name = name.substr(dot + 1);
+    }
+    res.name_ = name;
+    res.value_ = std::atof(str.c_str() + eq + 1);
+    return true;
+}
+
+//! Checks if the scenario name matches the filter
+bool matches(const std::string& name, const std::string& filter) {
+    if (filter.empty())
+        return true;
+    size_t start = 0;
+    while (start <= filter.size()) {
+        size_t end = filter.find(',', start);
+        if (end == std::string::npos)
+            end = filter.size();
+        if (end > start && name.find(filter.substr(start, end - start)) != std::string::npos)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+void list_scenarios() {
+    for (const auto& s : bench_scenarios())
+        printf("%-24s %s\n%-24s   params: %s\n", s.name_.c_str(), s.description_.c_str(), "",
+                s.params_.to_string().c_str());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    profiling_sleep profiling_helper;
+    CONCORE_PROFILING_FUNCTION();
+
+    cmd_line args{argc, argv};
+    if (args.has("list")) {
+        list_scenarios();
+        return 0;
+    }
+
+    std::string filter = args.get("filter");
+    int warmup = std::max(0, args.get_int("warmup", 1));
+    int reps = std::max(1, args.get_int("reps", 5));
+    auto fmt = parse_output_format(args.get("format", "text"));
+
+    std::vector<param_override> overrides;
+    for (const auto& str : args.get_all("param")) {
+        param_override o;
+        if (!parse_override(str, o)) {
+            fprintf(stderr, "bench: invalid parameter override '%s'; expected name=value\n",
+                    str.c_str());
+            return 1;
+        }
+        overrides.push_back(o);
+    }
+
+    calibrate_cpu_work();
+
+    results_table table{{"scenario", "params", "reps", "metric", "mean", "median", "stddev", "min",
+            "max"}};
+    int num_run = 0;
+    for (const auto& scenario : bench_scenarios()) {
+        if (!matches(scenario.name_, filter))
+            continue;
+        num_run++;
+
+        // Apply the generic overrides first, so that the scenario-specific ones take precedence
+        bench_params params = scenario.params_;
+        for (auto& o : overrides)
+            if (o.scenario_.empty() && params.set(o.name_, o.value_))
+                o.used_ = true;
+        for (auto& o : overrides)
+            if (o.scenario_ == scenario.name_ && params.set(o.name_, o.value_))
+                o.used_ = true;
+
+        fprintf(stderr, "Running %s (%s)\n", scenario.name_.c_str(), params.to_string().c_str());
+        if (scenario.setup_)
+            scenario.setup_(params);
+
+        for (int i = 0; i < warmup; i++) {
+            bench_metrics ignored;
+            scenario.run_(params, ignored);
+        }
+
+        // The samples for each metric, in the order in which the metrics were first reported
+        std::vector<std::string> metric_names{"wall_ms"};
+        std::map<std::string, std::vector<double>> samples;
+        for (int i = 0; i < reps; i++) {
+            bench_metrics metrics;
+            samples["wall_ms"].push_back(time_ms([&] { scenario.run_(params, metrics); }));
+            for (const auto& m : metrics.values()) {
+                auto& vals = samples[m.first];
+                if (vals.empty())
+                    metric_names.push_back(m.first);
+                vals.push_back(m.second);
+            }
+        }
+
+        for (const auto& name : metric_names) {
+            auto st = compute_stats(samples[name]);
+            table.row()
+                    .add(scenario.name_)
+                    .add(params.to_string())
+                    .add(st.count_)
+                    .add(name)
+                    .add(st.mean_)
+                    .add(st.median_)
+                    .add(st.stddev_)
+                    .add(st.min_)
+                    .add(st.max_);
+        }
+    }
+
+    for (const auto& o : overrides)
+        if (!o.used_)
+            fprintf(stderr, "bench: warning: parameter override '%s%s%s' was not used\n",
+                    o.scenario_.c_str(), o.scenario_.empty() ? "" : ".", o.name_.c_str());
+    if (num_run == 0) {
+        fprintf(stderr, "bench: no scenario matches '%s'; use --list to see the scenarios\n",
+                filter.c_str());
+        return 1;
+    }
+
+    table.print(fmt);
+    return 0;
+}